@@ -0,0 +1,249 @@
+/*
+ * ENC38J60 Multicast DNS - compile-time configuration
+ * 
+ * Copyright (c) 2013, Arno Moonen <info@arnom.nl>
+ * Copyright (c) 2013 Tony DiCola (tony@tonydicola.com)
+ *
+ * Every optional feature of the responder is selected here. A feature that is
+ * set to 0 has its own code and RAM compiled out, and the defaults below give
+ * the smallest build: a responder for the A record of one name. Features are
+ * not independent, though: most of them need the record store (see
+ * MDNS_RECORD_STORE below), which costs more than the rest of the responder.
+ * Compiled with g++ -Os for x86-64, the defaults take 2.2KB of code (the
+ * original responder took 1.0KB, but answered only the first question and no
+ * legacy or QU queries), MDNS_ENABLE_SERVICES alone 9.2KB.
+ *
+ * The Arduino IDE compiles libraries without the sketch's defines, so either
+ * edit the values in this file or pass them on the compiler command line
+ * (e.g. build_flags = -DMDNS_ENABLE_STATS=1 with PlatformIO).
+ *
+ * License (MIT license): see EC_MDNSResponder.h
+ */
+
+#ifndef EtherCard_MDNS_Config_h
+#define EtherCard_MDNS_Config_h
+
+// Set to 1 to advertise DNS-SD services (see addService()).
+#ifndef MDNS_ENABLE_SERVICES
+  #define MDNS_ENABLE_SERVICES 0
+#endif
+
+// Records the responder can hold, at most 32. Our host name takes two (A and
+// NSEC), every service three (PTR, SRV and TXT), every subtype one (PTR) and
+// every distinct service type one (PTR for service type enumeration).
+// Independent of this, all names share a pool of at most 254 bytes: two bytes
+// per distinct label plus the label itself ("local" and each service type are
+// stored once). With long instance names the pool runs out first: five or six
+// services with 35 character names fill it.
+#ifndef MDNS_MAX_RECORDS
+  #if MDNS_ENABLE_SERVICES
+    #define MDNS_MAX_RECORDS 14
+  #else
+    #define MDNS_MAX_RECORDS 2
+  #endif
+#endif
+
+// Hosts without mDNS that we answer address queries for (see addProxyHost()).
+// Kept apart from our own records, each takes 7 bytes of RAM plus its name.
+#ifndef MDNS_PROXY_HOSTS
+  #define MDNS_PROXY_HOSTS 0
+#endif
+
+// Key/value pairs in TXT records, over all services (see setTxt()), and the
+// longest TXT record they encode to (at most 245 bytes).
+#ifndef MDNS_TXT_ENTRIES
+  #define MDNS_TXT_ENTRIES 4
+#endif
+#ifndef MDNS_MAX_TXT
+  #define MDNS_MAX_TXT 100
+#endif
+
+// Services whose TXT values can come from a callback (see setTxtProvider()).
+#ifndef MDNS_TXT_PROVIDERS
+  #define MDNS_TXT_PROVIDERS 2
+#endif
+
+// Largest response payload. EtherCard's makeUdpReply() sends at most 220 bytes.
+#ifndef MDNS_MAX_PACKET
+  #define MDNS_MAX_PACKET 220
+#endif
+
+// Number of names remembered while writing a response, so that later copies
+// can be written as a pointer to the first one.
+#ifndef MDNS_COMPRESSION_ENTRIES
+  #define MDNS_COMPRESSION_ENTRIES 8
+#endif
+
+// Set to 1 to also answer plain DNS queries on port 53 for a zone the router
+// forwards to us (see setDnsZone()).
+#ifndef MDNS_ENABLE_UNICAST_DNS
+  #define MDNS_ENABLE_UNICAST_DNS 0
+#endif
+
+// Set to 1 to also answer LLMNR (RFC 4795) queries for our single-label
+// names, e.g. "arduino", which Windows asks before falling back to NetBIOS.
+#ifndef MDNS_ENABLE_LLMNR
+  #define MDNS_ENABLE_LLMNR 0
+#endif
+
+// Set to 1 to also answer NetBIOS name queries (broadcast on UDP port 137) for
+// our host name, as older Windows tools and HMIs still send them.
+#ifndef MDNS_ENABLE_NBNS
+  #define MDNS_ENABLE_NBNS 0
+#endif
+
+// Set to 1 to look up other names in the DNS zone with mDNS on the local link
+// and answer the DNS query with what comes back, as a discovery proxy. Only
+// address (A and AAAA) lookups are proxied.
+#ifndef MDNS_ENABLE_DISCOVERY_PROXY
+  #define MDNS_ENABLE_DISCOVERY_PROXY 0
+#endif
+
+// Answers kept for their TTL, including proofs from NSEC records that a name
+// has no data of a type.
+#ifndef MDNS_PROXY_CACHE
+  #define MDNS_PROXY_CACHE 4
+#endif
+
+// DNS queries that can wait for an mDNS answer at the same time.
+#ifndef MDNS_PROXY_LOOKUPS
+  #define MDNS_PROXY_LOOKUPS 4
+#endif
+
+// Longest name looked up, in bytes and without the zone.
+#ifndef MDNS_PROXY_NAME
+  #define MDNS_PROXY_NAME 32
+#endif
+
+// How long a lookup waits (ms) before the name is reported not to exist.
+#ifndef MDNS_PROXY_TIMEOUT
+  #define MDNS_PROXY_TIMEOUT 1000
+#endif
+
+// Number of name patterns whose records come from the sketch (see
+// addNameProvider()). With any, the response buffer is MDNS_MAX_PACKET bytes.
+#ifndef MDNS_NAME_PROVIDERS
+  #define MDNS_NAME_PROVIDERS 0
+#endif
+
+// Set to 1 to leave out of answers the records a querier lists as already
+// known (RFC 6762, section 7.1). On by default with services, whose browsers
+// send long known-answer lists.
+#ifndef MDNS_ENABLE_KNOWN_ANSWERS
+  #define MDNS_ENABLE_KNOWN_ANSWERS MDNS_ENABLE_SERVICES
+#endif
+
+// Number of truncated queries (TC bit set) that can wait at the same time for
+// the known answers following them, each for 400-500ms. Their answers are
+// sent from poll(). 0 answers truncated queries right away. Needs
+// MDNS_ENABLE_KNOWN_ANSWERS.
+#ifndef MDNS_DEFERRED_QUERIES
+  #if MDNS_ENABLE_KNOWN_ANSWERS
+    #define MDNS_DEFERRED_QUERIES 2
+  #else
+    #define MDNS_DEFERRED_QUERIES 0
+  #endif
+#endif
+
+// Set to 1 to keep counters of the work done by the responder (see getStats()).
+// When 0 the counters and the code updating them are compiled out entirely.
+#ifndef MDNS_ENABLE_STATS
+  #define MDNS_ENABLE_STATS 0
+#endif
+
+// Set to 1 to trace how long answered queries take from onUdpReceive() to
+// the answer leaving through EtherCard (see getLatency()).
+#ifndef MDNS_ENABLE_LATENCY
+  #define MDNS_ENABLE_LATENCY 0
+#endif
+
+// Free-running clock used for latency tracing, and the unsigned type as wide
+// as the clock, in which intervals are taken so they survive its wrap.
+// micros() ticks every 4us on a 16MHz AVR. For cycle resolution run Timer1
+// free with no prescaler, define the clock as TCNT1 and the type as uint16_t
+// (intervals then have to stay below 65536 cycles, ~4ms). Host builds can use
+// rdtsc or clock_gettime().
+#ifndef MDNS_LATENCY_CLOCK
+  #define MDNS_LATENCY_CLOCK() micros()
+#endif
+#ifndef MDNS_LATENCY_TYPE
+  #define MDNS_LATENCY_TYPE uint32_t
+#endif
+
+// Set to 1 to keep the first bytes of the last few received packets, and what
+// was done with them, for post-mortem analysis (see dumpCapture()).
+#ifndef MDNS_ENABLE_CAPTURE
+  #define MDNS_ENABLE_CAPTURE 0
+#endif
+
+// Number of packets kept, and bytes kept of each. Every entry takes
+// MDNS_CAPTURE_BYTES + 11 bytes of RAM.
+#ifndef MDNS_CAPTURE_ENTRIES
+  #define MDNS_CAPTURE_ENTRIES 8
+#endif
+#ifndef MDNS_CAPTURE_BYTES
+  #define MDNS_CAPTURE_BYTES 32
+#endif
+
+// Set to 1 to track which hosts send the most packets (see getTopTalkers()).
+#ifndef MDNS_ENABLE_TOPTALKERS
+  #define MDNS_ENABLE_TOPTALKERS 0
+#endif
+
+// Number of hosts tracked. Counts are halved every MDNS_TOPTALKER_WINDOW ms,
+// so a host sending r packets per window settles between r and 2r.
+// With k counters and N the sum of all counts, every count overestimates by at
+// most N/k (reported as error) and every host whose count is above N/k is
+// guaranteed to be in the table.
+#ifndef MDNS_TOPTALKER_COUNTERS
+  #define MDNS_TOPTALKER_COUNTERS 4
+#endif
+#ifndef MDNS_TOPTALKER_WINDOW
+  #define MDNS_TOPTALKER_WINDOW 1000
+#endif
+
+// Stop answering a host once it is known to have a count of at least this
+// many packets, 0 to never stop answering.
+#ifndef MDNS_TOPTALKER_LIMIT
+  #define MDNS_TOPTALKER_LIMIT 0
+#endif
+
+// Trace messages up to this level are compiled in, 0 compiles all of them out.
+// Messages are kept in flash and handed to the sink set with setTraceSink().
+#ifndef MDNS_TRACE_LEVEL
+  #define MDNS_TRACE_LEVEL 0
+#endif
+
+// The features that keep more than the A record of our own name need the
+// record store: a pool of names, a table of pre-encoded records and a writer
+// that splits answers over several packets. Without any of them the responder
+// answers for its one name with code made for just that.
+#if MDNS_ENABLE_SERVICES || MDNS_PROXY_HOSTS > 0 || MDNS_NAME_PROVIDERS > 0 || \
+    MDNS_ENABLE_UNICAST_DNS || MDNS_ENABLE_LLMNR || MDNS_ENABLE_KNOWN_ANSWERS
+  #define MDNS_RECORD_STORE 1
+#else
+  #define MDNS_RECORD_STORE 0
+#endif
+
+#define MDNS_TRACE_ERROR 1
+#define MDNS_TRACE_WARN  2
+#define MDNS_TRACE_INFO  3
+#define MDNS_TRACE_DEBUG 4
+
+#if MDNS_MAX_RECORDS + MDNS_PROXY_HOSTS > 32
+  #error "MDNS_MAX_RECORDS and MDNS_PROXY_HOSTS add up to more than 32"
+#endif
+
+#if MDNS_DEFERRED_QUERIES > 0 && !MDNS_ENABLE_KNOWN_ANSWERS
+  #error "MDNS_DEFERRED_QUERIES needs MDNS_ENABLE_KNOWN_ANSWERS"
+#endif
+
+#if MDNS_ENABLE_DISCOVERY_PROXY && !MDNS_ENABLE_UNICAST_DNS
+  #error "MDNS_ENABLE_DISCOVERY_PROXY needs MDNS_ENABLE_UNICAST_DNS"
+#endif
+
+#if MDNS_TOPTALKER_LIMIT > 0 && !MDNS_ENABLE_TOPTALKERS
+  #error "MDNS_TOPTALKER_LIMIT needs MDNS_ENABLE_TOPTALKERS"
+#endif
+
+#endif
@@ -8,8 +8,9 @@
  * created by Tony DiCola <tony@tonydicola.com>.
  *
  * This is a simple implementation of multicast DNS query support for an Arduino
- * and ENC28J60 ethernet module. Only support for resolving address queries is
- * currently implemented.
+ * and ENC28J60 ethernet module. It answers address queries for its host name
+ * and, with MDNS_ENABLE_SERVICES, advertises DNS-SD services (PTR, SRV and TXT
+ * records).
  *
  * Requirements:
  * - EtherCard (with UDP enhancements): https://github.com/itavero/ethercard/tree/enhancements
@@ -38,188 +39,2453 @@
 
 #define MDNS_ADDR {224, 0, 0, 251}
 #define MDNS_PORT 5353
+#define DNS_PORT 53
+#define LLMNR_ADDR {224, 0, 0, 252}
+#define LLMNR_PORT 5355
+#define NBNS_PORT 137
+#define NBNS_NAME_SIZE 34     // Length byte, 32 encoded characters and root
+#define NBNS_NAME_CHARS 15    // NetBIOS names are 15 characters and a suffix
 #define HEADER_SIZE 12
 #define QDCOUNT_OFFSET 4
-#define A_RECORD_SIZE 14
-#define NSEC_RECORD_SIZE 20
-#define TTL_OFFSET 4
-#define IP_OFFSET 10
-
-// TODO: Put these in flash, or refactor away into better state handling.
-uint8_t EC_MDNSResponder::_queryHeader[] = { 
-  0x00, 0x00, // ID = 0
-  0x00, 0x00, // Flags = query
-  0x00, 0x00, // Question count = ignored
-  0x00, 0x00, // Answer count = ignored
-  0x00, 0x00, // Name server records = ignored
-  0x00, 0x00  // Additional records = ignored
-};
-
-uint8_t* EC_MDNSResponder::_queryFQDN = NULL;
-int EC_MDNSResponder::_queryFQDNLen = 0;
-uint8_t* EC_MDNSResponder::_current = NULL;
-int EC_MDNSResponder::_currentLen = 0;
-int EC_MDNSResponder::_index = 0;
-uint8_t EC_MDNSResponder::_FQDNcount = 0;
+#define ANCOUNT_OFFSET 6
+#define MAX_LABEL_SIZE 63
+#define MAX_LABELS 8
+#define MAX_POINTERS 8        // Compression pointers followed per name
+
+#define TYPE_A 1
+#define TYPE_PTR 12
+#define TYPE_TXT 16
+#define TYPE_AAAA 28
+#define TYPE_NB 32            // NetBIOS name (RFC 1002)
+#define TYPE_SRV 33
+#define TYPE_NSEC 47
+#define TYPE_ANY 255
+#define CLASS_IN 1
+#define CACHE_FLUSH 0x8000
+#define FLAGS_RESPONSE 0x8400 // Response + authoritative answer
+#define FLAGS_AA 0x0400       // Authoritative answer
+#define FLAGS_TC 0x0200       // Truncated
+#define FLAGS_RD 0x0100       // Recursion desired, copied from the query
+#define FLAGS_LLMNR 0x8000    // Response, not a conflict or tentative
+#define RCODE_FORMERR 1
+#define RCODE_SERVFAIL 2
+#define RCODE_NXDOMAIN 3
+#define RCODE_NOTIMP 4
+#define RCODE_REFUSED 5
+#define LEGACY_TTL 10         // Longest TTL in answers to legacy unicast queries
+#define POINTER 0xC000
+#define MAX_POINTER_OFFSET 0x4000 // Pointers hold a 14-bit offset
+#define DEFER_MIN 400         // Wait for known answers after a truncated query,
+#define DEFER_SPREAD 100      // plus up to this much at random (RFC 6762, 7.2)
+#define ANNOUNCE_COUNT 2      // Announcements of a changed record (RFC 6762, 8.4)
+#define ANNOUNCE_INTERVAL 1000
+
+// Offsets in the encoded part of a record
+#define RECORD_TTL 4
+#define RECORD_RDLENGTH 8
+#define RECORD_RDATA 10
+#define A_RECORD_SIZE (RECORD_RDATA + 4)
+#define NSEC_RECORD_SIZE (RECORD_RDATA + 8) // Next domain as a pointer and bitmap
+
+// begin() adds our address as the first record, and the NSEC record saying
+// it is our only one as the second
+#define ADDRESS_RECORD 0
+#define NSEC_RECORD 1
+
+#define RECORD_BIT(index) ((MDNSRecordSet)1 << (index))
+#define PROXY_BIT(index) RECORD_BIT(MDNS_MAX_RECORDS + (index))
+#define RECORD_SLOTS (MDNS_MAX_RECORDS + MDNS_PROXY_HOSTS)
+
+#if MDNS_ENABLE_STATS
+  #define STAT(expr) (_stats.expr)
+#else
+  #define STAT(expr)
+#endif
+
+#if MDNS_ENABLE_LATENCY
+  #define STAMP(point) (_stamps[point] = MDNS_LATENCY_CLOCK())
+#else
+  #define STAMP(point)
+#endif
+
+#if MDNS_ENABLE_CAPTURE
+  #define CAPTURE(decision) capturePacket(src_ip, data, len, decision)
+#else
+  #define CAPTURE(decision)
+#endif
+
+#define REJECT(reason) do { STAT(rejects[reason]++); CAPTURE(reason); } while (0)
+
+EtherCard EC_MDNSResponder::etherCard;
+uint8_t* EC_MDNSResponder::_names = NULL;
+uint8_t EC_MDNSResponder::_namesLen = 0;
+#if MDNS_RECORD_STORE
+uint8_t EC_MDNSResponder::_hostName = MDNS_NO_NAME;
+#endif
+uint32_t EC_MDNSResponder::_ttl = 0;
+#if MDNS_ENABLE_UNICAST_DNS
+uint8_t EC_MDNSResponder::_zone = MDNS_NO_NAME;
+bool EC_MDNSResponder::_unicast = false;
+bool EC_MDNSResponder::_inZone = false;
+#endif
+#if MDNS_ENABLE_LLMNR
+bool EC_MDNSResponder::_llmnr = false;
+#endif
+#if MDNS_ENABLE_DISCOVERY_PROXY
+uint8_t EC_MDNSResponder::_zoneLabels = 0;
+EC_MDNSResponder::CachedAnswer EC_MDNSResponder::_cache[MDNS_PROXY_CACHE];
+EC_MDNSResponder::Lookup EC_MDNSResponder::_lookups[MDNS_PROXY_LOOKUPS];
+#endif
+#if MDNS_RECORD_STORE
+EC_MDNSResponder::Record EC_MDNSResponder::_records[MDNS_MAX_RECORDS];
+uint8_t EC_MDNSResponder::_recordCount = 0;
+uint8_t* EC_MDNSResponder::_wire = NULL;
+uint16_t EC_MDNSResponder::_wireLen = 0;
+#endif
+#if MDNS_ENABLE_SERVICES
+EC_MDNSResponder::TxtEntry EC_MDNSResponder::_txt[MDNS_TXT_ENTRIES];
+uint8_t EC_MDNSResponder::_txtCount = 0;
+MDNSRecordSet EC_MDNSResponder::_announce = 0;
+uint8_t EC_MDNSResponder::_announceLeft = 0;
+uint32_t EC_MDNSResponder::_announceDue = 0;
+EC_MDNSResponder::TxtProvider EC_MDNSResponder::_txtProviders[MDNS_TXT_PROVIDERS];
+uint8_t EC_MDNSResponder::_txtProviderCount = 0;
+bool EC_MDNSResponder::_providing = false;
+#endif
 char* EC_MDNSResponder::_response = NULL;
-int EC_MDNSResponder::_responseLen = 0;
+uint16_t EC_MDNSResponder::_responseSize = 0;
+uint16_t EC_MDNSResponder::_responseLen = 0;
+bool EC_MDNSResponder::_responseFull = false;
+#if MDNS_RECORD_STORE
+uint8_t EC_MDNSResponder::_writtenNames[MDNS_COMPRESSION_ENTRIES];
+uint16_t EC_MDNSResponder::_writtenAt[MDNS_COMPRESSION_ENTRIES];
+uint8_t EC_MDNSResponder::_writtenCount = 0;
+#else
+uint16_t EC_MDNSResponder::_nameAt = 0;
+#endif
+#if MDNS_PROXY_HOSTS > 0
+EC_MDNSResponder::ProxyHost EC_MDNSResponder::_proxies[MDNS_PROXY_HOSTS];
+uint8_t EC_MDNSResponder::_proxyCount = 0;
+#endif
+#if MDNS_NAME_PROVIDERS > 0
+EC_MDNSResponder::NameProvider EC_MDNSResponder::_nameProviders[MDNS_NAME_PROVIDERS];
+uint8_t EC_MDNSResponder::_nameProviderCount = 0;
+EC_MDNSResponder::ProvidedQuestion EC_MDNSResponder::_provided;
+#endif
+#if MDNS_DEFERRED_QUERIES > 0
+EC_MDNSResponder::Deferred EC_MDNSResponder::_deferred[MDNS_DEFERRED_QUERIES];
+#endif
+#if MDNS_ENABLE_STATS
+EC_MDNSStats EC_MDNSResponder::_stats;
+#endif
+#if MDNS_ENABLE_LATENCY
+EC_MDNSLatency EC_MDNSResponder::_latency;
+MDNS_LATENCY_TYPE EC_MDNSResponder::_stamps[MDNS_STAMP_COUNT];
+#endif
+#if MDNS_ENABLE_TOPTALKERS
+EC_MDNSTalker EC_MDNSResponder::_talkers[MDNS_TOPTALKER_COUNTERS];
+uint32_t EC_MDNSResponder::_talkersDecayed = 0;
+#endif
+#if MDNS_TRACE_LEVEL > 0
+MDNSTraceSink EC_MDNSResponder::_traceSink = NULL;
+#endif
+#if MDNS_ENABLE_CAPTURE
+EC_MDNSCaptureEntry EC_MDNSResponder::_capture[MDNS_CAPTURE_ENTRIES];
+uint8_t EC_MDNSResponder::_captureNext = 0;
+uint8_t EC_MDNSResponder::_captureCount = 0;
+#endif
 
 bool EC_MDNSResponder::begin(const char* domain, EtherCard& ether, uint32_t ttlSeconds)
 { 
   etherCard = ether;
+  _ttl = ttlSeconds;
 
-  // Construct DNS request/response fully qualified domain name of form:
-  // <domain length>, <domain characters>, 5, "local"
   size_t n = strlen(domain);
-  if (n > 255) {
-    // Can only handle domains that are 255 chars in length.
+  if (n == 0 || n > MAX_LABEL_SIZE) {
+    // A DNS label holds at most 63 characters.
+    MDNS_TRACE_E("bad domain length (%u)", (unsigned)n);
     return false;
   }
-  _queryFQDNLen = 8 + n;
-  if (_queryFQDN != NULL) {
-    free(_queryFQDN);
-  }
-  _queryFQDN = (uint8_t*) malloc(_queryFQDNLen);
-  if (_queryFQDN == NULL) {
+
+  free(_names);
+  free(_response);
+#if MDNS_RECORD_STORE
+  // Start over with no names and no records, then add <domain>.local to
+  // the name pool.
+  _names = NULL;
+  _namesLen = 0;
+  free(_wire);
+  _wire = NULL;
+  _wireLen = 0;
+  _recordCount = 0;
+#if MDNS_ENABLE_UNICAST_DNS
+  _zone = MDNS_NO_NAME;
+#endif
+#if MDNS_ENABLE_DISCOVERY_PROXY
+  memset(_cache, 0, sizeof(_cache));
+  memset(_lookups, 0, sizeof(_lookups));
+#endif
+#if MDNS_PROXY_HOSTS > 0
+  _proxyCount = 0;
+#endif
+#if MDNS_ENABLE_SERVICES
+  _txtCount = 0;
+  _txtProviderCount = 0;
+  _announce = 0;
+#endif
+  _response = NULL;
+  _responseSize = 0;
+#if MDNS_NAME_PROVIDERS > 0
+  _nameProviderCount = 0;
+#endif
+#if MDNS_DEFERRED_QUERIES > 0
+  memset(_deferred, 0, sizeof(_deferred));
+#endif
+  uint8_t local = addName(MDNS_NO_NAME, "local", 5);
+  _hostName = addName(local, domain, n);
+  if (_hostName == MDNS_NO_NAME) {
+    MDNS_TRACE_E("out of memory for name");
     return false;
   }
-  _queryFQDN[0] = (uint8_t)n;
-  // Copy in domain characters as lowercase
-  for (int i = 0; i < n; ++i) {
-    _queryFQDN[1+i] = tolower(domain[i]);
-  }
-  // Values for 5 (length), "local":
-  uint8_t local[] = { 0x05, 0x6C, 0x6F, 0x63, 0x61, 0x6C };
-  memcpy(&_queryFQDN[1+n], local, 6);
-  _queryFQDN[7+n] = 0;
 
-  // Construct DNS query response
-  // TODO: Move these to flash or just construct in code.
-  uint8_t respHeader[] = { 0x00, 0x00,   // ID = 0
-                           0x84, 0x00,   // Flags = response + authoritative answer
-                           0x00, 0x00,   // Question count = 0
-                           0x00, 0x01,   // Answer count = 1
-                           0x00, 0x00,   // Name server records = 0
-                           0x00, 0x01    // Additional records = 1
-  };
-  
-  // Generate positive response for IPV4 address
-  uint8_t aRecord[] = { 0x00, 0x01,                // Type = 1, A record/IPV4 address
-                        0x80, 0x01,                // Class = Internet, with cache flush bit
-                        0x00, 0x00, 0x00, 0x00,    // TTL in seconds, to be filled in later
-                        0x00, 0x04,                // Length of record
-                        0x00, 0x00, 0x00, 0x00     // IP address, to be filled in later
-  };
-  
-  // Generate negative response for IPV6 address (CC3000 doesn't support IPV6)
-  uint8_t nsecRecord[] = {  0xC0, 0x0C,                // Name offset
-                            0x00, 0x2F,                // Type = 47, NSEC (overloaded by MDNS)
-                            0x80, 0x01,                // Class = Internet, with cache flush bit
-                            0x00, 0x00, 0x00, 0x00,    // TTL in seconds, to be filled in later
-                            0x00, 0x08,                // Length of record
-                            0xC0, 0x0C,                // Next domain = offset to FQDN
-                            0x00,                      // Block number = 0
-                            0x04,                      // Length of bitmap = 4 bytes
-                            0x40, 0x00, 0x00, 0x00     // Bitmap value = Only first bit (A record/IPV4) is set
-  };
-  
-  // Allocate memory for response.
-  _responseLen = HEADER_SIZE + _queryFQDNLen + A_RECORD_SIZE + NSEC_RECORD_SIZE;
-  if (_response != NULL) {
-    free(_response);
-  }
-  _response = (char*) malloc(_responseLen);
-  if (_response == NULL) {
+  // Positive response for IPV4 address, kept up to date when written
+  addRecord(_hostName, TYPE_A, CLASS_IN | CACHE_FLUSH, ether.myip, 4, MDNS_NO_NAME, 0);
+  // Negative response for IPV6 address (ENC28J60 doesn't support IPV6):
+  // next domain = our name, block 0 with only the A record bit set.
+  uint8_t bitmap[] = { 0x00, 0x04, 0x40, 0x00, 0x00, 0x00 };
+  if (addRecord(_hostName, TYPE_NSEC, CLASS_IN | CACHE_FLUSH, bitmap, sizeof(bitmap), _hostName, 0) == MDNS_NO_RECORD) {
+    MDNS_TRACE_E("out of memory for records");
     return false;
   }
-  
-  // Copy data into response.
-  memcpy(_response, respHeader, HEADER_SIZE);
-  memcpy(_response + HEADER_SIZE, _queryFQDN, _queryFQDNLen);
-  char* records = _response + HEADER_SIZE + _queryFQDNLen;
-  memcpy(records, aRecord, A_RECORD_SIZE);
-  memcpy(records + A_RECORD_SIZE, nsecRecord, NSEC_RECORD_SIZE);
-  
-  // Add TTL to records.
-  uint8_t ttl[4] = { (uint8_t)(ttlSeconds >> 24), (uint8_t)(ttlSeconds >> 16), (uint8_t)(ttlSeconds >> 8), (uint8_t)ttlSeconds };
-  memcpy(records + TTL_OFFSET, ttl, 4);
-  memcpy(records + A_RECORD_SIZE + 2 + TTL_OFFSET, ttl, 4);
-  
-  // Add IP address to response
-  for(byte z = 0; z < 4; z++) {
-	  records[IP_OFFSET + z] = ether.myip[z];
+#else
+  // Only <domain>.local, kept as it is written in a response. The response
+  // buffer fits the largest answer: the question of a legacy query with our
+  // name in full, then the A and NSEC records pointing back at it.
+  _namesLen = 1 + n + 7;
+  _names = (uint8_t*) malloc(_namesLen);
+  _responseSize = HEADER_SIZE + _namesLen + 4 + 2 + A_RECORD_SIZE + 2 + NSEC_RECORD_SIZE;
+  _response = (char*) malloc(_responseSize);
+  if (_names == NULL || _response == NULL) {
+    MDNS_TRACE_E("out of memory for name");
+    return false;
   }
+  _names[0] = n;
+  memcpy(_names + 1, domain, n);
+  memcpy(_names + 1 + n, "\5local", 7);
+#endif
   
   // Register callback with EtherCard instance
   ether.disableMulticast(); // Disable multicast filter (necessary)
   uint8_t addr[4] = MDNS_ADDR;
   ether.udpServerListen(onUdpReceive, addr, MDNS_PORT, false);
+#if MDNS_ENABLE_LLMNR
+  uint8_t llmnr[4] = LLMNR_ADDR;
+  ether.udpServerListen(onLlmnrReceive, llmnr, LLMNR_PORT, false);
+#endif
+#if MDNS_ENABLE_NBNS
+  ether.enableBroadcast();
+  ether.udpServerListen(onNbnsReceive, ether.broadcastip, NBNS_PORT, false);
+#endif
   
-  // Start in a state of parsing the DNS query header.
-  changeState(_queryHeader);
+  MDNS_TRACE_I("listening, names %u bytes", _namesLen);
 
   return true;
 }
 
 void EC_MDNSResponder::onUdpReceive(uint8_t dest_ip[4], uint16_t dest_port, uint8_t src_ip[4], const char *data, uint16_t len) {
 
-	// Compare incoming data to expected data from current state
-	for(uint16_t i = 0; i < len; i++) {
-		uint8_t ch = data[i];
-
-		// If we're processing an FQDN character, make the comparison case insensitive.
-		if (_current == _queryFQDN && _FQDNcount > 0) {
-		  ch = tolower(ch);
-		}
-
-		// Check character matches expected, or in the case of parsing the question counts
-		// ignore it completely (this is done because MDNS queries on different platforms
-		// sometimes ask for different record types).
-		if (ch == _current[_index] ||
-			(_current == _queryHeader && _index >= QDCOUNT_OFFSET)) 
-		{
-		  // Update FQDN char count when processing FQDN characters.
-		  if (_current == _queryFQDN) {
-			if (_FQDNcount == 0) {
-			  // Handle the next characters as case insensitive FQDN characters.
-			  _FQDNcount = ch;
+#if MDNS_ENABLE_LATENCY
+	// Nothing left over from the last query
+	memset(_stamps, 0, sizeof(_stamps));
+#endif
+	STAMP(MDNS_STAMP_ENTRY);
+	STAT(packets++);
+#if MDNS_ENABLE_TOPTALKERS && MDNS_TOPTALKER_LIMIT > 0
+	EC_MDNSTalker* talker = countTalker(src_ip);
+#elif MDNS_ENABLE_TOPTALKERS
+	countTalker(src_ip);
+#endif
+
+	const uint8_t* msg = (const uint8_t*) data;
+	if (len < HEADER_SIZE) {
+		REJECT(MDNS_REJECT_SHORT);
+		MDNS_TRACE_D("short packet (%u)", len);
+		return;
+	}
+
+	// Only standard queries are answered: QR = 0, opcode = 0 and rcode = 0.
+	if ((msg[2] & 0xF8) || (msg[3] & 0x0F)) {
+		STAT(bytesScanned += HEADER_SIZE);
+		REJECT(MDNS_REJECT_HEADER);
+		MDNS_TRACE_D("not a query");
+#if MDNS_ENABLE_DISCOVERY_PROXY
+		// Responses may hold what proxied lookups wait for.
+		if ((msg[2] & 0x80) && !(msg[3] & 0x0F)) {
+			cacheResponse(msg, len);
+			answerLookups();
+		}
+#endif
+		return;
+	}
+
+	// Walk all questions. Every byte is read at most once, except for names
+	// reached through compression pointers. Those are only followed backwards,
+	// through at most MAX_POINTERS pointers and MAX_LABELS labels per name, so
+	// each name costs a bounded amount of work and the packet as a whole is
+	// linear in its length whatever it contains.
+	uint16_t qdcount = (msg[QDCOUNT_OFFSET] << 8) | msg[QDCOUNT_OFFSET + 1];
+	uint16_t pos = HEADER_SIZE;
+	MDNSRecordSet answers = 0;
+	// Queries not sent from port 5353 come from plain DNS resolvers, which
+	// need their ID and question repeated (RFC 6762, section 6.7).
+	LegacyQuery legacy;
+	legacy.id = (msg[0] << 8) | msg[1];
+	legacy.flags = FLAGS_RESPONSE;
+	legacy.port = MDNS_PORT;
+	legacy.name = MDNS_NO_NAME;
+#if MDNS_ENABLE_UNICAST_DNS || MDNS_ENABLE_LLMNR
+	legacy.question = NULL;
+#endif
+	uint16_t srcPort = (Ethernet::buffer[UDP_SRC_PORT_H_P] << 8) | Ethernet::buffer[UDP_SRC_PORT_L_P];
+#if MDNS_NAME_PROVIDERS > 0
+	_provided.provider = MDNS_NAME_PROVIDERS;
+#endif
+	for (uint16_t q = 0; q < qdcount; q++) {
+		uint8_t name;
+		uint16_t label;
+		uint8_t parent = MDNS_NO_NAME;
+		pos = parseName(msg, len, pos, &name, &label, &parent);
+		if (pos == 0 || pos + 4 > len) {
+			STAT(bytesScanned += len);
+			REJECT(MDNS_REJECT_MALFORMED);
+			MDNS_TRACE_D("malformed question %u", q);
+			return;
+		}
+		uint16_t type = (msg[pos] << 8) | msg[pos + 1];
+		pos += 4;
+
+		MDNSRecordSet found = matchRecords(name, type);
+		if (found) {
+			answers |= found;
+			if (legacy.name == MDNS_NO_NAME) {
+				legacy.name = name;
+				legacy.type = type;
+				legacy.cls = (msg[pos - 2] << 8) | msg[pos - 1];
+			}
+#if MDNS_ENABLE_STATS
+			countQuestion(type);
+#endif
+		}
+#if MDNS_NAME_PROVIDERS > 0
+		else if (parent != MDNS_NO_NAME && matchProvider(msg + label, parent, type) && legacy.name == MDNS_NO_NAME) {
+			legacy.type = type;
+			legacy.cls = (msg[pos - 2] << 8) | msg[pos - 1];
+		}
+#endif
+	}
+	bool provided = false;
+#if MDNS_NAME_PROVIDERS > 0
+	provided = _provided.provider != MDNS_NAME_PROVIDERS;
+#endif
+
+#if MDNS_ENABLE_KNOWN_ANSWERS
+	// Known answers follow the questions (RFC 6762, section 7.1). They also
+	// apply to a truncated query from the same host still waiting for them.
+	MDNSRecordSet known = parseKnownAnswers(msg, len, &pos);
+#endif
+	STAT(bytesScanned += pos);
+#if MDNS_DEFERRED_QUERIES > 0
+	bool truncated = msg[2] & (FLAGS_TC >> 8);
+	Deferred* deferred = findDeferred(src_ip);
+	if (deferred != NULL) {
+		STAT(answersSuppressed += countRecords(deferred->answers & known));
+		deferred->answers &= ~known;
+		if (truncated) {
+			// Still more to come.
+			deferred->due = millis() + DEFER_MIN + random(DEFER_SPREAD);
+		}
+	}
+#endif
+
+	if (!answers && !provided) {
+		REJECT(MDNS_REJECT_NAME);
+		MDNS_TRACE_D("no question for us");
+		return;
+	}
+#if MDNS_ENABLE_KNOWN_ANSWERS
+	if (answers & known) {
+		STAT(answersSuppressed += countRecords(answers & known));
+		answers &= ~known;
+		if (!answers && !provided) {
+			REJECT(MDNS_REJECT_KNOWN);
+			MDNS_TRACE_D("all answers known");
+			return;
+		}
+	}
+#endif
+
+#if MDNS_ENABLE_TOPTALKERS && MDNS_TOPTALKER_LIMIT > 0
+	// Only hold back answers from hosts certain to be over the limit.
+	if (talker->count - talker->error >= MDNS_TOPTALKER_LIMIT) {
+		REJECT(MDNS_REJECT_RATE);
+		MDNS_TRACE_W("rate limiting %u.%u.%u.%u", src_ip[0], src_ip[1], src_ip[2], src_ip[3]);
+		return;
+	}
+#endif
+
+#if MDNS_DEFERRED_QUERIES > 0
+	// Legacy resolvers don't send known answers, answer them right away. So
+	// are truncated queries when there is no room to hold them.
+	if (truncated && !provided && srcPort == MDNS_PORT && deferAnswers(src_ip, answers)) {
+		STAT(queriesDeferred++);
+		CAPTURE(MDNS_DEFERRED);
+		MDNS_TRACE_D("deferring %u.%u.%u.%u", src_ip[0], src_ip[1], src_ip[2], src_ip[3]);
+		return;
+	}
+#endif
+
+	STAMP(MDNS_STAMP_MATCH);
+	// Capture before replying, EtherCard builds the reply over the query.
+	CAPTURE(MDNS_ANSWERED);
+	MDNS_TRACE_I("answering %u.%u.%u.%u", src_ip[0], src_ip[1], src_ip[2], src_ip[3]);
+	if (sendResponse(answers, additionalRecords(answers), srcPort != MDNS_PORT ? &legacy : NULL, false)) {
+#if MDNS_ENABLE_LATENCY
+		// Only answers that went out have a complete set of stamps.
+		recordLatency();
+#endif
+	}
+}
+
+#if MDNS_RECORD_STORE
+uint8_t EC_MDNSResponder::addName(uint8_t parent, const char* label, uint8_t len) {
+  uint8_t node = findName(parent, (const uint8_t*) label, len);
+  if (node != MDNS_NO_NAME) {
+    return node;
+  }
+  // Entries are addressed by their offset, which has to stay below MDNS_NO_NAME.
+  if (_namesLen + 2 + len >= MDNS_NO_NAME) {
+    MDNS_TRACE_E("name pool full");
+    return MDNS_NO_NAME;
+  }
+  uint8_t* names = (uint8_t*) realloc(_names, _namesLen + 2 + len);
+  if (names == NULL) {
+    return MDNS_NO_NAME;
+  }
+  _names = names;
+  node = _namesLen;
+  _names[node] = parent;
+  _names[node + 1] = len;
+  memcpy(&_names[node + 2], label, len);
+  _namesLen += 2 + len;
+  return node;
+}
+
+uint8_t EC_MDNSResponder::addNames(const char* name) {
+  // From the last label to the first
+  uint8_t node = MDNS_NO_NAME;
+  const char* end = name + strlen(name);
+  while (end > name) {
+    const char* dot = end;
+    while (dot > name && dot[-1] != '.') {
+      dot--;
+    }
+    if (dot == end || end - dot > MAX_LABEL_SIZE) {
+      return MDNS_NO_NAME;
+    }
+    node = addName(node, dot, end - dot);
+    if (node == MDNS_NO_NAME) {
+      return MDNS_NO_NAME;
+    }
+    end = dot > name ? dot - 1 : dot;
+  }
+  return node;
+}
+
+uint8_t EC_MDNSResponder::findName(uint8_t parent, const uint8_t* label, uint8_t len) {
+  for (uint16_t node = 0; node < _namesLen; node += 2 + _names[node + 1]) {
+    if (_names[node] != parent || _names[node + 1] != len) {
+      continue;
+    }
+    // Names compare case insensitive.
+    uint8_t i = 0;
+    while (i < len && tolower(_names[node + 2 + i]) == tolower(label[i])) {
+      i++;
+    }
+    if (i == len) {
+      return node;
+    }
+  }
+  return MDNS_NO_NAME;
+}
+
+uint16_t EC_MDNSResponder::parseName(const uint8_t* msg, uint16_t len, uint16_t pos, uint8_t* node, uint16_t* label, uint8_t* parent) {
+  uint16_t labels[MAX_LABELS];
+  uint8_t count = 0;
+  uint16_t end = 0;
+  // Compression pointers have to point before the labels they follow, so a
+  // name can't loop. They may still chain through each other, so only so
+  // many are followed.
+  uint16_t start = pos;
+  uint8_t hops = 0;
+
+  *node = MDNS_NO_NAME;
+  while (true) {
+    if (pos >= len) {
+      return 0;
+    }
+    uint8_t l = msg[pos];
+    if ((l & 0xC0) == 0xC0) {
+      if (pos + 1 >= len) {
+        return 0;
+      }
+      uint16_t target = ((l & 0x3F) << 8) | msg[pos + 1];
+      if (target >= start || ++hops > MAX_POINTERS) {
+        return 0;
+      }
+      if (end == 0) {
+        end = pos + 2;
+      }
+      pos = start = target;
+    }
+    else if (l > MAX_LABEL_SIZE || pos + 1 + l > len) {
+      return 0;
+    }
+    else if (l == 0) {
+      if (end == 0) {
+        end = pos + 1;
+      }
+      break;
+    }
+    else if (count == MAX_LABELS) {
+      // Deeper than any of our names, no need to read the rest.
+      return end != 0 ? end : skipName(msg, len, pos);
+    }
+    else {
+      labels[count++] = pos;
+      pos += 1 + l;
+    }
+  }
+
+  // Look the name up from its last label, "local", to its first.
+  uint8_t n = MDNS_NO_NAME;
+#if MDNS_ENABLE_LLMNR
+  if (_llmnr) {
+    n = _names[_hostName];
+  }
+#endif
+  while (count > 0) {
+    count--;
+    if (count == 0 && parent != NULL) {
+      *label = labels[0];
+      *parent = n;
+    }
+    n = findName(n, &msg[labels[count] + 1], msg[labels[count]]);
+    if (n == MDNS_NO_NAME) {
+      return end;
+    }
+#if MDNS_ENABLE_UNICAST_DNS
+    if (_unicast && n == _zone) {
+      n = _names[_hostName];
+      _inZone = true;
+    }
+#endif
+  }
+  *node = n;
+  return end;
+}
+
+#else
+uint16_t EC_MDNSResponder::parseName(const uint8_t* msg, uint16_t len, uint16_t pos, uint8_t* node, uint16_t* label, uint8_t* parent) {
+  // Compare the name with ours as it is read, under the same rules for
+  // compression pointers as with the name pool. Either ours or no name at
+  // all: the first byte that differs ends the comparison.
+  uint16_t end = 0;
+  uint16_t start = pos;
+  uint8_t hops = 0;
+  uint8_t n = 0;
+
+  *node = MDNS_NO_NAME;
+  while (true) {
+    if (pos >= len) {
+      return 0;
+    }
+    uint8_t l = msg[pos];
+    if ((l & 0xC0) == 0xC0) {
+      if (pos + 1 >= len) {
+        return 0;
+      }
+      uint16_t target = ((l & 0x3F) << 8) | msg[pos + 1];
+      if (target >= start || ++hops > MAX_POINTERS) {
+        return 0;
+      }
+      if (end == 0) {
+        end = pos + 2;
+      }
+      pos = start = target;
+      continue;
+    }
+    if (l > MAX_LABEL_SIZE || pos + 1 + l > len) {
+      return 0;
+    }
+    // Label lengths are below 'A', so they compare like the characters.
+    for (uint8_t i = 0; i <= l; i++, n++) {
+      if (n == _namesLen || tolower(msg[pos + i]) != tolower(_names[n])) {
+        return end != 0 ? end : skipName(msg, len, pos);
+      }
+    }
+    if (l == 0) {
+      *node = 0;
+      return end != 0 ? end : pos + 1;
+    }
+    pos += 1 + l;
+  }
+}
+#endif
+
+uint16_t EC_MDNSResponder::skipName(const uint8_t* msg, uint16_t len, uint16_t pos) {
+  while (pos < len) {
+    uint8_t l = msg[pos];
+    if ((l & 0xC0) == 0xC0) {
+      return pos + 2 <= len ? pos + 2 : 0;
+    }
+    if (l == 0) {
+      return pos + 1;
+    }
+    if (l > MAX_LABEL_SIZE) {
+      return 0;
+    }
+    pos += 1 + l;
+  }
+  return 0;
+}
+
+void EC_MDNSResponder::writeBytes(const void* bytes, uint16_t len) {
+  if (_responseLen + len > _responseSize) {
+    _responseFull = true;
+    return;
+  }
+  memcpy(_response + _responseLen, bytes, len);
+  _responseLen += len;
+}
+
+void EC_MDNSResponder::write16(uint16_t value) {
+  uint8_t bytes[2] = { (uint8_t)(value >> 8), (uint8_t)value };
+  writeBytes(bytes, 2);
+}
+
+void EC_MDNSResponder::write32(uint32_t value) {
+  write16(value >> 16);
+  write16(value);
+}
+
+uint8_t EC_MDNSResponder::countRecords(MDNSRecordSet records) {
+  uint8_t n = 0;
+  for (; records; records &= records - 1) {
+    n++;
+  }
+  return n;
+}
+
+#if MDNS_RECORD_STORE
+void EC_MDNSResponder::writeName(uint8_t node) {
+  while (node != MDNS_NO_NAME) {
+#if MDNS_ENABLE_UNICAST_DNS
+    if (_unicast && node == _names[_hostName]) {
+      node = _zone;
+    }
+#endif
+#if MDNS_ENABLE_LLMNR
+    if (_llmnr && node == _names[_hostName]) {
+      break;
+    }
+#endif
+    // Point to the rest of the name if it's already in the response.
+    for (uint8_t i = 0; i < _writtenCount; i++) {
+      if (_writtenNames[i] == node) {
+        write16(POINTER | _writtenAt[i]);
+        return;
+      }
+    }
+    if (_writtenCount < MDNS_COMPRESSION_ENTRIES && _responseLen < MAX_POINTER_OFFSET) {
+      _writtenNames[_writtenCount] = node;
+      _writtenAt[_writtenCount] = _responseLen;
+      _writtenCount++;
+    }
+    writeBytes(&_names[node + 1], _names[node + 1] + 1);
+    node = _names[node];
+  }
+  writeBytes("", 1);
+}
+
+uint8_t EC_MDNSResponder::addRecord(uint8_t name, uint16_t type, uint16_t cls, const uint8_t* rdata, uint8_t rdlength, uint8_t target, uint8_t targetAt) {
+  if (_recordCount == MDNS_MAX_RECORDS || name == MDNS_NO_NAME) {
+    return MDNS_NO_RECORD;
+  }
+  uint8_t wireLen = RECORD_RDATA + rdlength;
+  uint8_t* wire = (uint8_t*) realloc(_wire, _wireLen + wireLen);
+  if (wire == NULL) {
+    return MDNS_NO_RECORD;
+  }
+  _wire = wire;
+
+  // Encode everything but the names now. rdlength is fixed up when a target
+  // name is written into the rdata.
+  wire += _wireLen;
+  uint8_t head[RECORD_RDATA] = {
+    (uint8_t)(type >> 8), (uint8_t)type,
+    (uint8_t)(cls >> 8), (uint8_t)cls,
+    (uint8_t)(_ttl >> 24), (uint8_t)(_ttl >> 16), (uint8_t)(_ttl >> 8), (uint8_t)_ttl,
+    0x00, rdlength
+  };
+  memcpy(wire, head, RECORD_RDATA);
+  if (rdlength > 0) {
+    memcpy(wire + RECORD_RDATA, rdata, rdlength);
+  }
+
+  Record& r = _records[_recordCount];
+  r.name = name;
+  r.target = target;
+  r.targetAt = targetAt;
+  r.wireLen = wireLen;
+  r.wire = _wireLen;
+  _wireLen += wireLen;
+  _recordCount++;
+
+  if (!reserveResponse()) {
+    _recordCount--;
+    _wireLen -= wireLen;
+    return MDNS_NO_RECORD;
+  }
+  return _recordCount - 1;
+}
+
+#if MDNS_ENABLE_SERVICES
+bool EC_MDNSResponder::setRdata(uint8_t index, const uint8_t* rdata, uint8_t rdlength) {
+  // Only for records without a target name. The records after it in _wire
+  // move along when its length changes.
+  Record& r = _records[index];
+  if (rdlength > 0xFF - RECORD_RDATA) {
+    return false;
+  }
+  uint8_t wireLen = RECORD_RDATA + rdlength;
+  if (wireLen > r.wireLen) {
+    uint8_t* wire = (uint8_t*) realloc(_wire, _wireLen + wireLen - r.wireLen);
+    if (wire == NULL) {
+      return false;
+    }
+    _wire = wire;
+  }
+  uint16_t tail = r.wire + r.wireLen;
+  memmove(_wire + r.wire + wireLen, _wire + tail, _wireLen - tail);
+  for (uint8_t i = 0; i < _recordCount; i++) {
+    if (_records[i].wire > r.wire) {
+      _records[i].wire += wireLen - r.wireLen;
+    }
+  }
+  _wireLen += wireLen - r.wireLen;
+  r.wireLen = wireLen;
+
+  uint8_t* wire = _wire + r.wire;
+  wire[RECORD_RDLENGTH] = 0;
+  wire[RECORD_RDLENGTH + 1] = rdlength;
+  memcpy(wire + RECORD_RDATA, rdata, rdlength);
+  // A response buffer that can't grow only means fewer records per packet.
+  reserveResponse();
+  return true;
+}
+#endif
+
+bool EC_MDNSResponder::reserveResponse() {
+  // Each label in the pool is written in full at most once, every other
+  // reference to a name takes at most 2 bytes (pointer or terminating zero).
+  // Plus a question repeated for a legacy query.
+  uint16_t size = HEADER_SIZE + _namesLen + 6;
+  for (uint8_t i = 0; i < _recordCount; i++) {
+    size += _records[i].wireLen + 4;
+  }
+#if MDNS_PROXY_HOSTS > 0
+  size += _proxyCount * (RECORD_RDATA + 4 + 2);
+#endif
+#if MDNS_NAME_PROVIDERS > 0 || MDNS_ENABLE_DISCOVERY_PROXY
+  // No telling how large provided or proxied answers are.
+  size = MDNS_MAX_PACKET;
+#endif
+  if (size > MDNS_MAX_PACKET) {
+    size = MDNS_MAX_PACKET;
+  }
+  if (size <= _responseSize) {
+    return true;
+  }
+  char* response = (char*) realloc(_response, size);
+  if (response == NULL) {
+    return false;
+  }
+  _response = response;
+  _responseSize = size;
+  return true;
+}
+
+uint16_t EC_MDNSResponder::recordType(uint8_t index) {
+  const uint8_t* wire = _wire + _records[index].wire;
+  return (wire[0] << 8) | wire[1];
+}
+
+MDNSRecordSet EC_MDNSResponder::matchRecords(uint8_t name, uint16_t type) {
+  MDNSRecordSet found = 0;
+  MDNSRecordSet negative = 0;
+  for (uint8_t i = 0; i < _recordCount; i++) {
+    if (_records[i].name != name) {
+      continue;
+    }
+    uint16_t t = recordType(i);
+    if (type == TYPE_ANY || type == t) {
+      found |= RECORD_BIT(i);
+    }
+    else if (t == TYPE_NSEC) {
+      negative = RECORD_BIT(i);
+    }
+  }
+#if MDNS_PROXY_HOSTS > 0
+  for (uint8_t i = 0; i < _proxyCount; i++) {
+    if (_proxies[i].name == name && (type == TYPE_A || type == TYPE_ANY)) {
+      found |= PROXY_BIT(i);
+    }
+  }
+#endif
+  // No record of the type asked for, say so if the name has an NSEC.
+  return found ? found : negative;
+}
+
+MDNSRecordSet EC_MDNSResponder::additionalRecords(MDNSRecordSet answers) {
+  // PTR and SRV records bring the records of the name they point to, address
+  // records the other records of their name. Two rounds cover PTR -> SRV/TXT
+  // -> A/NSEC. PTR records are never additional, so enumerating service types
+  // does not pull in every instance.
+  MDNSRecordSet extra = 0;
+  for (uint8_t round = 0; round < 2; round++) {
+    MDNSRecordSet from = answers | extra;
+    for (uint8_t i = 0; i < _recordCount; i++) {
+      if (!(from & RECORD_BIT(i))) {
+        continue;
+      }
+      uint16_t type = recordType(i);
+      uint8_t name;
+      if (type == TYPE_PTR || type == TYPE_SRV) {
+        name = _records[i].target;
+      }
+      else if (type == TYPE_A || type == TYPE_NSEC) {
+        name = _records[i].name;
+      }
+      else {
+        continue;
+      }
+      for (uint8_t j = 0; j < _recordCount; j++) {
+        if (_records[j].name == name && recordType(j) != TYPE_PTR) {
+          extra |= RECORD_BIT(j);
+        }
+      }
+#if MDNS_PROXY_HOSTS > 0
+      for (uint8_t j = 0; j < _proxyCount; j++) {
+        if (_proxies[j].name == name) {
+          extra |= PROXY_BIT(j);
+        }
+      }
+#endif
+    }
+  }
+  return extra & ~answers;
+}
+
+void EC_MDNSResponder::writeRecord(uint8_t index, bool legacy) {
+#if MDNS_PROXY_HOSTS > 0
+  if (index >= MDNS_MAX_RECORDS) {
+    writeProxy(index - MDNS_MAX_RECORDS, legacy);
+    return;
+  }
+#endif
+  const Record& r = _records[index];
+  const uint8_t* wire = _wire + r.wire;
+
+  writeName(r.name);
+  uint16_t start = _responseLen;
+  if (r.target == MDNS_NO_NAME) {
+    writeBytes(wire, r.wireLen);
+  }
+  else {
+    // Copy up to the target, write it (compressed if possible), copy the
+    // rest and fix up the rdata length.
+    uint8_t split = RECORD_RDATA + r.targetAt;
+    writeBytes(wire, split);
+    writeName(r.target);
+    writeBytes(wire + split, r.wireLen - split);
+    if (!_responseFull) {
+      uint16_t rdlength = _responseLen - start - RECORD_RDATA;
+      _response[start + RECORD_RDLENGTH] = rdlength >> 8;
+      _response[start + RECORD_RDLENGTH + 1] = rdlength;
+    }
+  }
+  if (_responseFull) {
+    return;
+  }
+  if (index == ADDRESS_RECORD) {
+    memcpy(_response + start + RECORD_RDATA, etherCard.myip, 4);
+  }
+  if (legacy) {
+    // No cache flush bit outside of mDNS (RFC 6762, section 6.7).
+    _response[start + 2] &= ~(CACHE_FLUSH >> 8);
+    if (_ttl > LEGACY_TTL) {
+      uint8_t ttl[4] = { 0x00, 0x00, 0x00, LEGACY_TTL };
+      memcpy(_response + start + RECORD_TTL, ttl, 4);
+    }
+  }
+}
+
+#if MDNS_ENABLE_KNOWN_ANSWERS
+MDNSRecordSet EC_MDNSResponder::parseKnownAnswers(const uint8_t* msg, uint16_t len, uint16_t* pos) {
+  // A malformed answer ends the list, the answers before it still count.
+  uint16_t ancount = (msg[ANCOUNT_OFFSET] << 8) | msg[ANCOUNT_OFFSET + 1];
+  MDNSRecordSet known = 0;
+  uint16_t p = *pos;
+  for (uint16_t a = 0; a < ancount; a++) {
+    uint8_t name;
+    p = parseName(msg, len, p, &name);
+    if (p == 0 || p + RECORD_RDATA > len) {
+      break;
+    }
+    uint16_t type = (msg[p] << 8) | msg[p + 1];
+    uint32_t ttl = ((uint32_t)msg[p + 4] << 24) | ((uint32_t)msg[p + 5] << 16) | (msg[p + 6] << 8) | msg[p + 7];
+    uint16_t rdlength = (msg[p + 8] << 8) | msg[p + 9];
+    p += RECORD_RDATA;
+    if (p + rdlength > len) {
+      break;
+    }
+    *pos = p + rdlength;
+
+    for (uint8_t i = 0; name != MDNS_NO_NAME && i < _recordCount; i++) {
+      if (_records[i].name != name || recordType(i) != type) {
+        continue;
+      }
+      const uint8_t* wire = _wire + _records[i].wire;
+      uint32_t ours = ((uint32_t)wire[RECORD_TTL] << 24) | ((uint32_t)wire[RECORD_TTL + 1] << 16) |
+                      (wire[RECORD_TTL + 2] << 8) | wire[RECORD_TTL + 3];
+      if (ttl >= ours / 2 && sameRdata(i, msg, p, rdlength)) {
+        known |= RECORD_BIT(i);
+      }
+    }
+#if MDNS_PROXY_HOSTS > 0
+    for (uint8_t i = 0; name != MDNS_NO_NAME && type == TYPE_A && i < _proxyCount; i++) {
+      const ProxyHost& h = _proxies[i];
+      if (h.name == name && ttl >= h.ttl / 2 && rdlength == 4 && memcmp(msg + p, h.ip, 4) == 0) {
+        known |= PROXY_BIT(i);
+      }
+    }
+#endif
+    p += rdlength;
+  }
+  return known;
+}
+
+bool EC_MDNSResponder::sameRdata(uint8_t index, const uint8_t* msg, uint16_t pos, uint16_t rdlength) {
+  const Record& r = _records[index];
+  const uint8_t* rdata = _wire + r.wire + RECORD_RDATA;
+  uint8_t ourLength = r.wireLen - RECORD_RDATA;
+  if (index == ADDRESS_RECORD) {
+    rdata = etherCard.myip;
+  }
+  if (r.target == MDNS_NO_NAME) {
+    return rdlength == ourLength && memcmp(msg + pos, rdata, ourLength) == 0;
+  }
+
+  // Bytes before the target, the target (possibly compressed) and the rest.
+  uint16_t end = pos + rdlength;
+  if (rdlength < r.targetAt || memcmp(msg + pos, rdata, r.targetAt) != 0) {
+    return false;
+  }
+  uint8_t target;
+  pos = parseName(msg, end, pos + r.targetAt, &target);
+  uint8_t rest = ourLength - r.targetAt;
+  return pos != 0 && target == r.target && end - pos == rest &&
+         memcmp(msg + pos, rdata + r.targetAt, rest) == 0;
+}
+#endif
+
+#if MDNS_PROXY_HOSTS > 0
+void EC_MDNSResponder::writeProxy(uint8_t proxy, bool legacy) {
+  const ProxyHost& h = _proxies[proxy];
+  writeName(h.name);
+  write16(TYPE_A);
+  write16(legacy ? CLASS_IN : CLASS_IN | CACHE_FLUSH);
+  write32(legacy && h.ttl > LEGACY_TTL ? LEGACY_TTL : h.ttl);
+  write16(4);
+  writeBytes(h.ip, 4);
+}
+#endif
+
+bool EC_MDNSResponder::tryWriteRecord(uint8_t index, bool legacy) {
+  // Records are never truncated: take back whatever part did not fit.
+  uint16_t len = _responseLen;
+  uint8_t written = _writtenCount;
+  writeRecord(index, legacy);
+  if (_responseFull) {
+    _responseLen = len;
+    _writtenCount = written;
+    _responseFull = false;
+    return false;
+  }
+  return true;
+}
+
+void EC_MDNSResponder::rearmReply() {
+  // makeUdpReply() turns the received packet around in place. Turn it back
+  // so the next call replies to the same querier again.
+  uint8_t* buf = Ethernet::buffer;
+  memcpy(buf + ETH_SRC_MAC, buf + ETH_DST_MAC, 6);
+  memcpy(buf + IP_SRC_P, buf + IP_DST_P, 4);
+  buf[UDP_SRC_PORT_H_P] = buf[UDP_DST_PORT_H_P];
+  buf[UDP_SRC_PORT_L_P] = buf[UDP_DST_PORT_L_P];
+}
+
+void EC_MDNSResponder::sendTo(const uint8_t* ip, uint16_t sport, uint16_t dport, const uint8_t* mac) {
+  // Unlike replies these are not sent back where a packet came from.
+  // EtherCard addresses them to the gateway (or the last host it resolved),
+  // so the caller passes the MAC unless it is a multicast address.
+  etherCard.udpPrepare(sport, ip, dport);
+  if (mac != NULL) {
+    memcpy(Ethernet::buffer + ETH_DST_MAC, mac, 6);
+  }
+  else if ((ip[0] & 0xF0) == 0xE0) {
+    // Multicast MAC: 01:00:5E and the low 23 bits of the group
+    uint8_t* mac = Ethernet::buffer + ETH_DST_MAC;
+    mac[0] = 0x01;
+    mac[1] = 0x00;
+    mac[2] = 0x5E;
+    mac[3] = ip[1] & 0x7F;
+    mac[4] = ip[2];
+    mac[5] = ip[3];
+  }
+  memcpy(Ethernet::buffer + UDP_DATA_P, _response, _responseLen);
+  etherCard.udpTransmit(_responseLen);
+}
+
+#if MDNS_ENABLE_UNICAST_DNS || MDNS_ENABLE_LLMNR
+void EC_MDNSResponder::writeQuestion(const LegacyQuery* legacy) {
+  // The question as it came, which is as long as our name written out in
+  // full, so it fits where that would. Unless it is compressed itself, names
+  // in the answers can point to it: its labels are those of the name and the
+  // names it ends in, as writeName() would write them.
+  const uint8_t* q = legacy->question;
+  writeBytes(q, legacy->questionLen);
+  uint16_t pos = 0;
+  while (q[pos] != 0 && (q[pos] & 0xC0) == 0) {
+    pos += 1 + q[pos];
+  }
+  if (q[pos] != 0) {
+    return;
+  }
+  uint8_t node = legacy->name;
+  for (pos = 0; q[pos] != 0 && node != MDNS_NO_NAME && _writtenCount < MDNS_COMPRESSION_ENTRIES; pos += 1 + q[pos]) {
+#if MDNS_ENABLE_UNICAST_DNS
+    if (_unicast && node == _names[_hostName]) {
+      node = _zone;
+    }
+#endif
+    _writtenNames[_writtenCount] = node;
+    _writtenAt[_writtenCount] = HEADER_SIZE + pos;
+    _writtenCount++;
+    node = _names[node];
+  }
+}
+#endif
+
+bool EC_MDNSResponder::sendResponse(MDNSRecordSet answers, MDNSRecordSet additional, const LegacyQuery* legacy, bool multicast) {
+	// Fill packets greedily: answers first, then additional records in the
+	// space left. A record that does not fit waits for the next packet while
+	// smaller ones after it still get a chance. Additional records left over
+	// once all answers are out get packets of their own, except for legacy
+	// queries, which only take one packet.
+#if MDNS_ENABLE_SERVICES
+	refreshTxt(answers | additional);
+#endif
+	bool first = true;
+	bool provided = false;
+#if MDNS_NAME_PROVIDERS > 0
+	provided = !multicast && _provided.provider != MDNS_NAME_PROVIDERS;
+#endif
+	while (answers || provided || (additional && !legacy && !first)) {
+		_responseLen = 0;
+		_responseFull = false;
+		_writtenCount = 0;
+
+		write16(legacy ? legacy->id : 0);
+		write16(legacy ? legacy->flags : FLAGS_RESPONSE);
+		write16(legacy ? 1 : 0);  // Question count
+		write16(0);               // Answer count, filled in below
+		write16(0);               // Name server records = 0
+		write16(0);               // Additional records, filled in below
+#if MDNS_ENABLE_UNICAST_DNS || MDNS_ENABLE_LLMNR
+		if (legacy && legacy->question != NULL) {
+			writeQuestion(legacy);
+		}
+		else
+#endif
+		if (legacy) {
+#if MDNS_NAME_PROVIDERS > 0
+			if (legacy->name == MDNS_NO_NAME) {
+				writeProvidedName();
 			}
-			else {
-			  _FQDNcount--;
+			else
+#endif
+			writeName(legacy->name);
+			write16(legacy->type);
+			write16(legacy->cls);
+		}
+
+		uint8_t ancount = 0;
+		uint8_t arcount = 0;
+#if MDNS_NAME_PROVIDERS > 0
+		if (provided && writeProvided(legacy)) {
+			ancount++;
+		}
+		provided = false;
+#endif
+		for (uint8_t i = 0; i < RECORD_SLOTS; i++) {
+			if ((answers & RECORD_BIT(i)) && tryWriteRecord(i, legacy)) {
+				answers &= ~RECORD_BIT(i);
+				ancount++;
 			}
-		  }
-		  // Update state when the end of the current one has been reached.
-		  _index++;
-		  if (_index >= _currentLen) {
-			// Switch to next state
-			if (_current == _queryHeader) {
-			  changeState(_queryFQDN);
+		}
+		if (ancount == 0 && (answers || first)) {
+			// Even an empty packet can't hold what is left (or the provider had
+			// no answer after all).
+			if (answers) {
+				MDNS_TRACE_E("records do not fit a packet");
 			}
-			else if (_current == _queryFQDN) {
-			  sendResponse();
-			  changeState(_queryHeader);
+			break;
+		}
+		for (uint8_t i = 0; i < RECORD_SLOTS; i++) {
+			if ((additional & RECORD_BIT(i)) && tryWriteRecord(i, legacy)) {
+				additional &= ~RECORD_BIT(i);
+				arcount++;
 			}
-		  }
+		}
+		if (ancount == 0 && arcount == 0) {
+			MDNS_TRACE_E("records do not fit a packet");
+			break;
+		}
+
+		// Legacy resolvers only take one packet, tell them it is incomplete.
+		if (legacy && answers) {
+			_response[2] |= FLAGS_TC >> 8;
+		}
+		_response[7] = ancount;
+		_response[11] = arcount;
+
+		if (first) {
+			STAMP(MDNS_STAMP_BUILD);
+		}
+		if (multicast) {
+			uint8_t addr[4] = MDNS_ADDR;
+			sendTo(addr, MDNS_PORT, MDNS_PORT);
 		}
 		else {
-		  // Reset to start looking from the start again
-		  changeState(_queryHeader);
+			if (!first) {
+				rearmReply();
+			}
+			etherCard.makeUdpReply(_response, _responseLen, legacy ? legacy->port : MDNS_PORT);
+		}
+		STAT(answersSent++);
+		first = false;
+		if (legacy) {
+			break;
 		}
 	}
+	STAMP(MDNS_STAMP_SENT);
+	return !first;
 }
 
-void EC_MDNSResponder::changeState(uint8_t* state) {
-  _current = state;
-  if (state == _queryFQDN) {
-    _currentLen = _queryFQDNLen;
+#else
+MDNSRecordSet EC_MDNSResponder::matchRecords(uint8_t name, uint16_t type) {
+  // The A record for A and ANY, the NSEC record for NSEC and ANY, and
+  // otherwise to say there is no record of the type.
+  if (name == MDNS_NO_NAME) {
+    return 0;
   }
-  else if (state == _queryHeader) {
-    _currentLen = HEADER_SIZE;
+  if (type == TYPE_ANY) {
+    return RECORD_BIT(ADDRESS_RECORD) | RECORD_BIT(NSEC_RECORD);
   }
-  _index = 0;
-  _FQDNcount = 0;
+  return RECORD_BIT(type == TYPE_A ? ADDRESS_RECORD : NSEC_RECORD);
 }
 
-void EC_MDNSResponder::sendResponse() {
-	etherCard.makeUdpReply(_response, _responseLen, MDNS_PORT);
-}
\ No newline at end of file
+MDNSRecordSet EC_MDNSResponder::additionalRecords(MDNSRecordSet answers) {
+  // Each of our records brings the other one.
+  return answers ? ~answers & (RECORD_BIT(ADDRESS_RECORD) | RECORD_BIT(NSEC_RECORD)) : 0;
+}
+
+void EC_MDNSResponder::writeHostName() {
+  // In full the first time, then as a pointer to it.
+  if (_nameAt != 0) {
+    write16(POINTER | _nameAt);
+    return;
+  }
+  _nameAt = _responseLen;
+  writeBytes(_names, _namesLen);
+}
+
+void EC_MDNSResponder::writeRecord(uint8_t index, bool legacy) {
+  writeHostName();
+  write16(index == ADDRESS_RECORD ? TYPE_A : TYPE_NSEC);
+  // No cache flush bit outside of mDNS (RFC 6762, section 6.7).
+  write16(legacy ? CLASS_IN : CLASS_IN | CACHE_FLUSH);
+  write32(legacy && _ttl > LEGACY_TTL ? LEGACY_TTL : _ttl);
+  if (index == ADDRESS_RECORD) {
+    write16(4);
+    writeBytes(etherCard.myip, 4);
+  }
+  else {
+    // Next domain = our name, block 0 with only the A record bit set.
+    uint8_t bitmap[] = { 0x00, 0x04, 0x40, 0x00, 0x00, 0x00 };
+    write16(NSEC_RECORD_SIZE - RECORD_RDATA);
+    writeHostName();
+    writeBytes(bitmap, sizeof(bitmap));
+  }
+}
+
+bool EC_MDNSResponder::sendResponse(MDNSRecordSet answers, MDNSRecordSet additional, const LegacyQuery* legacy, bool multicast) {
+	// Both records always fit the buffer begin() made, so there is only
+	// ever one packet.
+	_responseLen = 0;
+	_nameAt = 0;
+	write16(legacy ? legacy->id : 0);
+	write16(legacy ? legacy->flags : FLAGS_RESPONSE);
+	write16(legacy ? 1 : 0);  // Question count
+	write16(countRecords(answers));
+	write16(0);               // Name server records = 0
+	write16(countRecords(additional));
+	if (legacy) {
+		writeHostName();
+		write16(legacy->type);
+		write16(legacy->cls);
+	}
+	for (uint8_t i = ADDRESS_RECORD; i <= NSEC_RECORD; i++) {
+		if (answers & RECORD_BIT(i)) {
+			writeRecord(i, legacy);
+		}
+	}
+	for (uint8_t i = ADDRESS_RECORD; i <= NSEC_RECORD; i++) {
+		if (additional & RECORD_BIT(i)) {
+			writeRecord(i, legacy);
+		}
+	}
+	STAMP(MDNS_STAMP_BUILD);
+	etherCard.makeUdpReply(_response, _responseLen, legacy ? legacy->port : MDNS_PORT);
+	STAT(answersSent++);
+	STAMP(MDNS_STAMP_SENT);
+	return true;
+}
+#endif
+
+void EC_MDNSResponder::poll() {
+#if MDNS_ENABLE_DISCOVERY_PROXY
+  for (uint8_t i = 0; i < MDNS_PROXY_LOOKUPS; i++) {
+    Lookup& l = _lookups[i];
+    if (l.name[0] != 0 && (int32_t)(millis() - l.due) >= 0) {
+      // Nothing of this type. If nothing at all was heard of the name, no one
+      // on the link has it.
+      uint16_t rcode = isCached(l.name, TYPE_ANY) ? 0 : RCODE_NXDOMAIN;
+      writeProxyReply(l.name, l.zoneCase, l.type, l.id, l.flags | rcode);
+      sendTo(l.ip, DNS_PORT, l.port, l.mac);
+      l.name[0] = 0;
+    }
+  }
+#endif
+#if MDNS_ENABLE_SERVICES
+  if (_announce && (int32_t)(millis() - _announceDue) >= 0) {
+    MDNS_TRACE_I("announcing");
+    sendResponse(_announce, 0, NULL, true);
+    _announceDue += ANNOUNCE_INTERVAL;
+    if (--_announceLeft == 0) {
+      _announce = 0;
+    }
+  }
+#endif
+#if MDNS_DEFERRED_QUERIES > 0
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < MDNS_DEFERRED_QUERIES; i++) {
+    Deferred& d = _deferred[i];
+    if (d.answers && (int32_t)(now - d.due) >= 0) {
+      MDNSRecordSet answers = d.answers;
+      d.answers = 0;
+      MDNS_TRACE_I("answering %u.%u.%u.%u", d.ip[0], d.ip[1], d.ip[2], d.ip[3]);
+      sendResponse(answers, additionalRecords(answers), NULL, true);
+    }
+  }
+#endif
+}
+
+#if MDNS_DEFERRED_QUERIES > 0
+EC_MDNSResponder::Deferred* EC_MDNSResponder::findDeferred(const uint8_t* ip) {
+  for (uint8_t i = 0; i < MDNS_DEFERRED_QUERIES; i++) {
+    if (_deferred[i].answers && memcmp(_deferred[i].ip, ip, 4) == 0) {
+      return &_deferred[i];
+    }
+  }
+  return NULL;
+}
+
+bool EC_MDNSResponder::deferAnswers(const uint8_t* ip, MDNSRecordSet answers) {
+  Deferred* d = findDeferred(ip);
+  for (uint8_t i = 0; d == NULL && i < MDNS_DEFERRED_QUERIES; i++) {
+    if (!_deferred[i].answers) {
+      d = &_deferred[i];
+      memcpy(d->ip, ip, 4);
+    }
+  }
+  if (d == NULL) {
+    return false;
+  }
+  d->answers |= answers;
+  d->due = millis() + DEFER_MIN + random(DEFER_SPREAD);
+  return true;
+}
+#endif
+
+#if MDNS_ENABLE_UNICAST_DNS
+bool EC_MDNSResponder::setDnsZone(const char* zone) {
+  _zone = addNames(zone);
+  if (_zone == MDNS_NO_NAME) {
+    MDNS_TRACE_E("bad DNS zone");
+    return false;
+  }
+#if MDNS_ENABLE_DISCOVERY_PROXY
+  _zoneLabels = 0;
+  for (uint8_t node = _zone; node != MDNS_NO_NAME; node = _names[node]) {
+    _zoneLabels++;
+  }
+#endif
+  etherCard.udpServerListen(onDnsReceive, etherCard.myip, DNS_PORT, false);
+  return true;
+}
+
+void EC_MDNSResponder::onDnsReceive(uint8_t dest_ip[4], uint16_t dest_port, uint8_t src_ip[4], const char *data, uint16_t len) {
+	const uint8_t* msg = (const uint8_t*) data;
+	// Responses are not ours to answer, and too short a packet has no ID to
+	// reply with.
+	if (len < HEADER_SIZE || (msg[2] & 0x80)) {
+		return;
+	}
+	uint16_t id = (msg[0] << 8) | msg[1];
+	uint16_t flags = FLAGS_RESPONSE | ((msg[2] << 8) & FLAGS_RD);
+	// Errors about queries that are not for our zone are not authoritative.
+	uint16_t notOurs = flags & ~FLAGS_AA;
+	if (msg[2] & 0x78) {
+		sendDnsError(id, notOurs | RCODE_NOTIMP, NULL, 0, DNS_PORT);
+		return;
+	}
+	uint16_t qdcount = (msg[QDCOUNT_OFFSET] << 8) | msg[QDCOUNT_OFFSET + 1];
+	uint8_t name;
+#if MDNS_NAME_PROVIDERS > 0
+	// Provided names are answered over mDNS only.
+	_provided.provider = MDNS_NAME_PROVIDERS;
+#endif
+	_unicast = true;
+	_inZone = false;
+	uint16_t pos = qdcount == 1 ? parseName(msg, len, HEADER_SIZE, &name) : 0;
+	_unicast = false;
+	if (pos == 0 || pos + 4 > len) {
+		sendDnsError(id, notOurs | RCODE_FORMERR, NULL, 0, DNS_PORT);
+		return;
+	}
+	uint16_t type = (msg[pos] << 8) | msg[pos + 1];
+	pos += 4;
+
+	// Names we know and unknown names in our zone get an authoritative
+	// answer, even if empty. Anything else is not ours.
+	if (!_inZone) {
+		MDNS_TRACE_D("DNS query outside zone");
+		sendDnsError(id, notOurs | RCODE_REFUSED, msg + HEADER_SIZE, pos - HEADER_SIZE, DNS_PORT);
+		return;
+	}
+	if (name == MDNS_NO_NAME) {
+#if MDNS_ENABLE_DISCOVERY_PROXY
+		// Not ours, maybe someone else's on the link. Look up the name without
+		// the zone in .local, reading it into the response buffer that is not
+		// in use yet.
+		uint8_t* full = (uint8_t*) _response;
+		if ((type == TYPE_A || type == TYPE_AAAA) &&
+				readName(msg, len, HEADER_SIZE, full, _responseSize < 0xFF ? _responseSize : 0xFF)) {
+			uint8_t* zone = labelAt(full, countLabels(full) - _zoneLabels);
+			if (zone > full && zone - full < MDNS_PROXY_NAME) {
+				uint8_t relative[MDNS_PROXY_NAME];
+				memcpy(relative, full, zone - full);
+				relative[zone - full] = 0;
+				// The zone goes back in the case it came in, as far as the mask
+				// reaches.
+				uint32_t zoneCase = 0;
+				uint8_t i = 0;
+				for (uint8_t node = _zone; node != MDNS_NO_NAME; node = _names[node]) {
+					for (uint8_t j = 0; j <= _names[node + 1]; j++, i++) {
+						if (i < 32 && zone[i] != _names[node + 1 + j]) {
+							zoneCase |= (uint32_t)1 << i;
+						}
+					}
+				}
+				uint16_t srcPort = (Ethernet::buffer[UDP_SRC_PORT_H_P] << 8) | Ethernet::buffer[UDP_SRC_PORT_L_P];
+				proxyLookup(relative, zoneCase, type, id, flags, src_ip, srcPort);
+				return;
+			}
+		}
+#endif
+		sendDnsError(id, flags | RCODE_NXDOMAIN, msg + HEADER_SIZE, pos - HEADER_SIZE, DNS_PORT);
+		return;
+	}
+	// Our NSEC records are an mDNS thing, here an empty answer says that a
+	// type is missing.
+	MDNSRecordSet nsec = 0;
+	for (uint8_t i = 0; i < _recordCount; i++) {
+		if (recordType(i) == TYPE_NSEC) {
+			nsec |= RECORD_BIT(i);
+		}
+	}
+	MDNSRecordSet answers = matchRecords(name, type);
+	if (type != TYPE_NSEC) {
+		answers &= ~nsec;
+	}
+	if (!answers) {
+		sendDnsError(id, flags, msg + HEADER_SIZE, pos - HEADER_SIZE, DNS_PORT);
+		return;
+	}
+
+	LegacyQuery query;
+	query.id = id;
+	query.flags = flags;
+	query.port = DNS_PORT;
+	query.name = name;
+	query.type = type;
+	query.cls = (msg[pos - 2] << 8) | msg[pos - 1];
+	// Resolvers may check that the case of the question comes back as sent.
+	query.question = msg + HEADER_SIZE;
+	query.questionLen = pos - HEADER_SIZE;
+	MDNS_TRACE_I("DNS answer to %u.%u.%u.%u", src_ip[0], src_ip[1], src_ip[2], src_ip[3]);
+	_unicast = true;
+	sendResponse(answers, additionalRecords(answers) & ~nsec, &query, false);
+	_unicast = false;
+}
+
+#endif
+
+#if MDNS_ENABLE_LLMNR
+void EC_MDNSResponder::onLlmnrReceive(uint8_t dest_ip[4], uint16_t dest_port, uint8_t src_ip[4], const char *data, uint16_t len) {
+	const uint8_t* msg = (const uint8_t*) data;
+	// Only standard queries with one question and nothing else (RFC 4795,
+	// section 2.1.1), everything else is dropped without a reply.
+	if (len < HEADER_SIZE || (msg[2] & 0xF8) || msg[4] != 0 || msg[5] != 1 ||
+			msg[6] != 0 || msg[7] != 0 || msg[8] != 0 || msg[9] != 0) {
+		return;
+	}
+	// Single labels only, "arduino" as the host name we have in .local
+	uint8_t l = msg[HEADER_SIZE];
+	if (l == 0 || l > MAX_LABEL_SIZE || HEADER_SIZE + 2 + l > len || msg[HEADER_SIZE + 1 + l] != 0) {
+		return;
+	}
+	uint8_t name;
+	_llmnr = true;
+	uint16_t pos = parseName(msg, len, HEADER_SIZE, &name);
+	_llmnr = false;
+	if (pos == 0 || pos + 4 > len || name == MDNS_NO_NAME) {
+		return;
+	}
+	uint16_t id = (msg[0] << 8) | msg[1];
+	uint16_t type = (msg[pos] << 8) | msg[pos + 1];
+	uint16_t cls = (msg[pos + 2] << 8) | msg[pos + 3];
+	pos += 4;
+
+	MDNSRecordSet nsec = 0;
+	for (uint8_t i = 0; i < _recordCount; i++) {
+		if (recordType(i) == TYPE_NSEC) {
+			nsec |= RECORD_BIT(i);
+		}
+	}
+	MDNSRecordSet answers = matchRecords(name, type);
+	if (type != TYPE_NSEC) {
+		answers &= ~nsec;
+	}
+	if (!answers) {
+		// Ours, but not of this type
+		sendDnsError(id, FLAGS_LLMNR, msg + HEADER_SIZE, pos - HEADER_SIZE, LLMNR_PORT);
+		return;
+	}
+
+#if MDNS_NAME_PROVIDERS > 0
+	_provided.provider = MDNS_NAME_PROVIDERS;
+#endif
+	LegacyQuery query;
+	query.id = id;
+	query.flags = FLAGS_LLMNR;
+	query.port = LLMNR_PORT;
+	query.name = name;
+	query.type = type;
+	query.cls = cls;
+	// The question section as it came, case included (RFC 4795, section 2.1.1)
+	query.question = msg + HEADER_SIZE;
+	query.questionLen = pos - HEADER_SIZE;
+	MDNS_TRACE_I("LLMNR answer to %u.%u.%u.%u", src_ip[0], src_ip[1], src_ip[2], src_ip[3]);
+	_llmnr = true;
+	sendResponse(answers, 0, &query, false);
+	_llmnr = false;
+}
+#endif
+
+#if MDNS_ENABLE_NBNS
+void EC_MDNSResponder::onNbnsReceive(uint8_t dest_ip[4], uint16_t dest_port, uint8_t src_ip[4], const char *data, uint16_t len) {
+#if MDNS_ENABLE_TOPTALKERS && MDNS_TOPTALKER_LIMIT > 0
+	EC_MDNSTalker* talker = countTalker(src_ip);
+#elif MDNS_ENABLE_TOPTALKERS
+	countTalker(src_ip);
+#endif
+
+	const uint8_t* msg = (const uint8_t*) data;
+	// A name query (opcode 0) with one question for an NB record of a name
+	// without scope.
+	uint16_t pos = HEADER_SIZE + NBNS_NAME_SIZE;
+	if (len < pos + 4 || (msg[2] & 0xF8) || msg[4] != 0 || msg[5] != 1 ||
+			msg[HEADER_SIZE] != NBNS_NAME_SIZE - 2 || msg[pos - 1] != 0 ||
+			((msg[pos] << 8) | msg[pos + 1]) != TYPE_NB || ((msg[pos + 2] << 8) | msg[pos + 3]) != CLASS_IN) {
+		return;
+	}
+
+	// First-level encoding: every byte of the upper case name, padded with
+	// spaces, is split into two nibbles written as 'A' + nibble. The suffix
+	// byte says what is asked for, workstation (0x00) or file server (0x20)
+	// names are ours.
+#if MDNS_RECORD_STORE
+	const uint8_t* host = &_names[_hostName + 2];
+	uint8_t hostLen = _names[_hostName + 1];
+#else
+	const uint8_t* host = &_names[1];
+	uint8_t hostLen = _names[0];
+#endif
+	const uint8_t* encoded = msg + HEADER_SIZE + 1;
+	for (uint8_t i = 0; i <= NBNS_NAME_CHARS; i++) {
+		uint8_t hi = encoded[2 * i] - 'A';
+		uint8_t lo = encoded[2 * i + 1] - 'A';
+		if (hi > 0x0F || lo > 0x0F) {
+			return;
+		}
+		uint8_t c = (hi << 4) | lo;
+		if (i == NBNS_NAME_CHARS ? c != 0x00 && c != 0x20 : c != (i < hostLen ? toupper(host[i]) : ' ')) {
+			return;
+		}
+	}
+
+#if MDNS_ENABLE_TOPTALKERS && MDNS_TOPTALKER_LIMIT > 0
+	if (talker->count - talker->error >= MDNS_TOPTALKER_LIMIT) {
+		MDNS_TRACE_W("rate limiting %u.%u.%u.%u", src_ip[0], src_ip[1], src_ip[2], src_ip[3]);
+		return;
+	}
+#endif
+
+	// Positive name query response: the name as asked, then our address as
+	// a unique B-node name (NB flags 0).
+	uint8_t reply[HEADER_SIZE + NBNS_NAME_SIZE + RECORD_RDATA + 6] = {
+		msg[0], msg[1],
+		(uint8_t)((FLAGS_RESPONSE >> 8) | (msg[2] & (FLAGS_RD >> 8))), 0x00,
+		0x00, 0x00,           // No question
+		0x00, 0x01,           // One answer
+		0x00, 0x00,
+		0x00, 0x00
+	};
+	memcpy(reply + HEADER_SIZE, msg + HEADER_SIZE, NBNS_NAME_SIZE);
+	uint8_t record[RECORD_RDATA + 6] = {
+		0x00, TYPE_NB,
+		0x00, CLASS_IN,
+		(uint8_t)(_ttl >> 24), (uint8_t)(_ttl >> 16), (uint8_t)(_ttl >> 8), (uint8_t)_ttl,
+		0x00, 6,
+		0x00, 0x00
+	};
+	memcpy(record + RECORD_RDATA + 2, etherCard.myip, 4);
+	memcpy(reply + HEADER_SIZE + NBNS_NAME_SIZE, record, sizeof(record));
+	MDNS_TRACE_I("NBNS answer to %u.%u.%u.%u", src_ip[0], src_ip[1], src_ip[2], src_ip[3]);
+	etherCard.makeUdpReply((const char*) reply, sizeof(reply), NBNS_PORT);
+}
+#endif
+
+#if MDNS_ENABLE_UNICAST_DNS || MDNS_ENABLE_LLMNR
+void EC_MDNSResponder::sendDnsError(uint16_t id, uint16_t flags, const uint8_t* question, uint16_t len, uint16_t port) {
+  // Header and the question as it came, if it fits.
+  _responseLen = 0;
+  _responseFull = false;
+  write16(id);
+  write16(flags);
+  write16(question != NULL && HEADER_SIZE + len <= _responseSize ? 1 : 0);
+  write16(0);
+  write16(0);
+  write16(0);
+  if (_response[5]) {
+    writeBytes(question, len);
+  }
+  etherCard.makeUdpReply(_response, _responseLen, port);
+}
+#endif
+
+#if MDNS_ENABLE_DISCOVERY_PROXY
+uint16_t EC_MDNSResponder::readName(const uint8_t* msg, uint16_t len, uint16_t pos, uint8_t* name, uint8_t size) {
+  // Same rules as parseName(): pointers only go backwards, and only
+  // MAX_POINTERS of them.
+  uint16_t end = 0;
+  uint16_t start = pos;
+  uint8_t hops = 0;
+  uint8_t n = 0;
+  while (true) {
+    if (pos >= len) {
+      return 0;
+    }
+    uint8_t l = msg[pos];
+    if ((l & 0xC0) == 0xC0) {
+      if (pos + 1 >= len) {
+        return 0;
+      }
+      uint16_t target = ((l & 0x3F) << 8) | msg[pos + 1];
+      if (target >= start || ++hops > MAX_POINTERS) {
+        return 0;
+      }
+      if (end == 0) {
+        end = pos + 2;
+      }
+      pos = start = target;
+    }
+    else if (l == 0) {
+      name[n] = 0;
+      return end != 0 ? end : pos + 1;
+    }
+    else if (l > MAX_LABEL_SIZE || pos + 1 + l > len || n + 1 + l >= size) {
+      return 0;
+    }
+    else {
+      memcpy(name + n, msg + pos, 1 + l);
+      n += 1 + l;
+      pos += 1 + l;
+    }
+  }
+}
+
+uint8_t EC_MDNSResponder::countLabels(const uint8_t* name) {
+  uint8_t count = 0;
+  for (; *name; name += 1 + *name) {
+    count++;
+  }
+  return count;
+}
+
+uint8_t* EC_MDNSResponder::labelAt(uint8_t* name, uint8_t index) {
+  for (; index > 0 && *name; index--) {
+    name += 1 + *name;
+  }
+  return name;
+}
+
+bool EC_MDNSResponder::sameName(const uint8_t* a, const uint8_t* b) {
+  // Label lengths are below 'A', so they compare as they are.
+  for (; tolower(*a) == tolower(*b); a++, b++) {
+    if (*a == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void EC_MDNSResponder::proxyLookup(const uint8_t* name, uint32_t zoneCase, uint16_t type, uint16_t id, uint16_t flags, const uint8_t* ip, uint16_t port) {
+  if (isCached(name, type)) {
+    writeProxyReply(name, zoneCase, type, id, flags);
+    etherCard.makeUdpReply(_response, _responseLen, DNS_PORT);
+    return;
+  }
+
+  // Wait for an answer, asking the link only if no one else is already.
+  Lookup* lookup = NULL;
+  bool asked = false;
+  for (uint8_t i = 0; i < MDNS_PROXY_LOOKUPS; i++) {
+    Lookup& l = _lookups[i];
+    if (l.name[0] == 0) {
+      lookup = lookup == NULL ? &l : lookup;
+    }
+    else if (l.type == type && sameName(l.name, name)) {
+      asked = true;
+    }
+  }
+  if (lookup == NULL) {
+    MDNS_TRACE_W("out of proxy lookups");
+    writeProxyReply(name, zoneCase, type, id, flags | RCODE_SERVFAIL);
+    etherCard.makeUdpReply(_response, _responseLen, DNS_PORT);
+    return;
+  }
+  memcpy(lookup->name, name, MDNS_PROXY_NAME);
+  lookup->zoneCase = zoneCase;
+  lookup->type = type;
+  lookup->id = id;
+  lookup->flags = flags;
+  memcpy(lookup->ip, ip, 4);
+  memcpy(lookup->mac, Ethernet::buffer + ETH_SRC_MAC, 6);
+  lookup->port = port;
+  lookup->due = millis() + MDNS_PROXY_TIMEOUT;
+  if (asked) {
+    return;
+  }
+
+  _responseLen = 0;
+  _responseFull = false;
+  _writtenCount = 0;
+  write16(0);      // ID
+  write16(0);      // Standard query
+  write16(1);      // Question count
+  write16(0);
+  write16(0);
+  write16(0);
+  writeBytes(name, labelAt((uint8_t*) name, 0xFF) - name);
+  writeName(_names[_hostName]);   // local
+  write16(type);
+  write16(CLASS_IN);
+  MDNS_TRACE_I("proxy lookup");
+  uint8_t addr[4] = MDNS_ADDR;
+  sendTo(addr, MDNS_PORT, MDNS_PORT);
+}
+
+uint8_t EC_MDNSResponder::writeProxyReply(const uint8_t* name, uint32_t zoneCase, uint16_t type, uint16_t id, uint16_t flags) {
+  // The question in the zone, then the cached answers pointing back at it.
+  _responseLen = 0;
+  _responseFull = false;
+  _writtenCount = 0;
+  write16(id);
+  write16(flags);
+  write16(1);
+  write16(0);
+  write16(0);
+  write16(0);
+  writeBytes(name, labelAt((uint8_t*) name, 0xFF) - name);
+  uint16_t zone = _responseLen;
+  writeName(_zone);
+  for (uint8_t i = 0; zoneCase != 0 && zone + i < _responseLen; i++, zoneCase >>= 1) {
+    if (zoneCase & 1) {
+      _response[zone + i] ^= 0x20;
+    }
+  }
+  write16(type);
+  write16(CLASS_IN);
+
+  uint8_t ancount = 0;
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < MDNS_PROXY_CACHE; i++) {
+    const CachedAnswer& c = _cache[i];
+    if (c.name[0] == 0 || c.type != type || c.rdlength == 0 || (int32_t)(c.expires - now) <= 0 || !sameName(c.name, name)) {
+      continue;
+    }
+    uint16_t len = _responseLen;
+    write16(POINTER | HEADER_SIZE);
+    write16(type);
+    write16(CLASS_IN);
+    write32((c.expires - now) / 1000);
+    write16(c.rdlength);
+    writeBytes(c.rdata, c.rdlength);
+    if (_responseFull) {
+      _responseLen = len;
+      _response[2] |= FLAGS_TC >> 8;
+      break;
+    }
+    ancount++;
+  }
+  _response[7] = ancount;
+  return ancount;
+}
+
+bool EC_MDNSResponder::isCached(const uint8_t* name, uint16_t type) {
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < MDNS_PROXY_CACHE; i++) {
+    const CachedAnswer& c = _cache[i];
+    if (c.name[0] != 0 && (type == TYPE_ANY || c.type == type) && (int32_t)(c.expires - now) > 0 && sameName(c.name, name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void EC_MDNSResponder::cacheResponse(const uint8_t* msg, uint16_t len) {
+  uint16_t qdcount = (msg[QDCOUNT_OFFSET] << 8) | msg[QDCOUNT_OFFSET + 1];
+  uint16_t pos = HEADER_SIZE;
+  for (uint16_t q = 0; q < qdcount; q++) {
+    pos = skipName(msg, len, pos);
+    if (pos == 0 || pos + 4 > len) {
+      return;
+    }
+    pos += 4;
+  }
+  // Every record counts, whatever section it is in.
+  uint16_t count = ((msg[6] << 8) | msg[7]) + ((msg[8] << 8) | msg[9]) + ((msg[10] << 8) | msg[11]);
+  for (uint16_t r = 0; r < count; r++) {
+    uint8_t name[MDNS_PROXY_NAME + 6];
+    uint16_t end = readName(msg, len, pos, name, sizeof(name));
+    if (end == 0) {
+      // Too long to be proxied, skip it.
+      name[0] = 0;
+      end = skipName(msg, len, pos);
+      if (end == 0) {
+        return;
+      }
+    }
+    pos = end;
+    if (pos + RECORD_RDATA > len) {
+      return;
+    }
+    uint16_t type = (msg[pos] << 8) | msg[pos + 1];
+    uint32_t ttl = ((uint32_t)msg[pos + 4] << 24) | ((uint32_t)msg[pos + 5] << 16) | (msg[pos + 6] << 8) | msg[pos + 7];
+    uint16_t rdlength = (msg[pos + 8] << 8) | msg[pos + 9];
+    pos += RECORD_RDATA;
+    if (pos + rdlength > len) {
+      return;
+    }
+
+    // Only addresses of names in .local, and NSEC records saying which of
+    // them a name does not have (RFC 6762, section 6.1).
+    uint8_t labels = countLabels(name);
+    uint8_t* local = labelAt(name, labels - 1);
+    if (labels > 1 && local - name < MDNS_PROXY_NAME && local[0] == 5 &&
+        strncasecmp((const char*) local + 1, "local", 5) == 0) {
+      *local = 0;
+      if ((type == TYPE_A || type == TYPE_AAAA) && rdlength > 0 && rdlength <= sizeof(_cache[0].rdata)) {
+        cacheAnswer(name, type, ttl, msg + pos, rdlength);
+      }
+      else if (type == TYPE_NSEC) {
+        // Next domain name, then the bitmap of window 0 (types 0-255).
+        uint16_t end = pos + rdlength;
+        uint16_t p = skipName(msg, end, pos);
+        bool hasA = true;
+        bool hasAAAA = true;
+        if (p != 0 && p + 2 <= end && msg[p] == 0 && msg[p + 1] <= 32 && p + 2 + msg[p + 1] <= end) {
+          const uint8_t* bitmap = msg + p + 2;
+          uint8_t size = msg[p + 1];
+          hasA = size > TYPE_A / 8 && (bitmap[TYPE_A / 8] & (0x80 >> (TYPE_A % 8)));
+          hasAAAA = size > TYPE_AAAA / 8 && (bitmap[TYPE_AAAA / 8] & (0x80 >> (TYPE_AAAA % 8)));
+        }
+        if (!hasA) {
+          cacheAnswer(name, TYPE_A, ttl, NULL, 0);
+        }
+        if (!hasAAAA) {
+          cacheAnswer(name, TYPE_AAAA, ttl, NULL, 0);
+        }
+      }
+    }
+    pos += rdlength;
+  }
+}
+
+void EC_MDNSResponder::cacheAnswer(const uint8_t* name, uint16_t type, uint32_t ttl, const uint8_t* rdata, uint8_t rdlength) {
+  // Keep only names that are looked up or already kept, whatever the type:
+  // any record shows that the name exists.
+  bool wanted = false;
+  for (uint8_t i = 0; i < MDNS_PROXY_LOOKUPS && !wanted; i++) {
+    wanted = _lookups[i].name[0] != 0 && sameName(_lookups[i].name, name);
+  }
+  uint32_t now = millis();
+  CachedAnswer* slot = NULL;
+  uint32_t slotLeft = 0;
+  bool found = false;
+  for (uint8_t i = 0; i < MDNS_PROXY_CACHE; i++) {
+    CachedAnswer& c = _cache[i];
+    if (c.name[0] != 0 && sameName(c.name, name)) {
+      wanted = true;
+      if (c.type == type && c.rdlength == rdlength && (rdlength == 0 || memcmp(c.rdata, rdata, rdlength) == 0)) {
+        slot = &c;
+        found = true;
+        break;
+      }
+      // An address replaces the proof that there is none, and the other way
+      // round.
+      if (c.type == type && ttl != 0 && (c.rdlength == 0 || rdlength == 0)) {
+        c.name[0] = 0;
+      }
+    }
+    // Otherwise replace the entry closest to expiring.
+    uint32_t left = c.name[0] != 0 && (int32_t)(c.expires - now) > 0 ? c.expires - now : 0;
+    if (slot == NULL || left < slotLeft) {
+      slot = &c;
+      slotLeft = left;
+    }
+  }
+  if (ttl == 0) {
+    // Goodbye packet
+    if (found) {
+      slot->name[0] = 0;
+    }
+    return;
+  }
+  if (!wanted) {
+    return;
+  }
+  memcpy(slot->name, name, MDNS_PROXY_NAME);
+  slot->type = type;
+  slot->rdlength = rdlength;
+  if (rdlength > 0) {
+    memcpy(slot->rdata, rdata, rdlength);
+  }
+  // Keep the expiry time in range of millis().
+  slot->expires = now + (ttl < 3600 ? ttl : 3600) * 1000;
+}
+
+void EC_MDNSResponder::answerLookups() {
+  for (uint8_t i = 0; i < MDNS_PROXY_LOOKUPS; i++) {
+    Lookup& l = _lookups[i];
+    if (l.name[0] != 0 && isCached(l.name, l.type)) {
+      writeProxyReply(l.name, l.zoneCase, l.type, l.id, l.flags);
+      sendTo(l.ip, DNS_PORT, l.port, l.mac);
+      l.name[0] = 0;
+    }
+  }
+}
+#endif
+
+#if MDNS_PROXY_HOSTS > 0
+uint8_t EC_MDNSResponder::addProxyHost(const char* name, const uint8_t ip[4], uint16_t ttlSeconds) {
+  size_t n = strlen(name);
+  if (_proxyCount == MDNS_PROXY_HOSTS || n == 0 || n > MAX_LABEL_SIZE) {
+    return MDNS_NO_PROXY;
+  }
+  // <name>.local, not one of ours
+  uint8_t node = addName(_names[_hostName], name, n);
+  if (node == MDNS_NO_NAME || node == _hostName) {
+    MDNS_TRACE_E("bad proxy host");
+    return MDNS_NO_PROXY;
+  }
+  ProxyHost& h = _proxies[_proxyCount];
+  h.name = node;
+  memcpy(h.ip, ip, 4);
+  h.ttl = ttlSeconds;
+  _proxyCount++;
+  if (!reserveResponse()) {
+    _proxyCount--;
+    return MDNS_NO_PROXY;
+  }
+  return _proxyCount - 1;
+}
+
+#if MDNS_ENABLE_SERVICES
+uint8_t EC_MDNSResponder::addProxyService(uint8_t host, const char* type, const char* protocol, uint16_t port, const char* instance) {
+  if (host >= _proxyCount) {
+    return MDNS_NO_SERVICE;
+  }
+  return addServiceFor(_proxies[host].name, type, protocol, port, instance);
+}
+#endif
+#endif
+
+#if MDNS_NAME_PROVIDERS > 0
+bool EC_MDNSResponder::addNameProvider(const char* prefix, const char* parent, MDNSNameProvider provider) {
+  if (_nameProviderCount == MDNS_NAME_PROVIDERS) {
+    return false;
+  }
+  uint8_t node = addNames(parent);
+  if (node == MDNS_NO_NAME) {
+    MDNS_TRACE_E("bad provider parent");
+    return false;
+  }
+  NameProvider& p = _nameProviders[_nameProviderCount++];
+  p.prefix = prefix;
+  p.parent = node;
+  p.provider = provider;
+  return true;
+}
+
+bool EC_MDNSResponder::matchProvider(const uint8_t* label, uint8_t parent, uint16_t type) {
+  if (_provided.provider != MDNS_NAME_PROVIDERS) {
+    return false;
+  }
+  for (uint8_t i = 0; i < _nameProviderCount; i++) {
+    const NameProvider& p = _nameProviders[i];
+    if (p.parent != parent) {
+      continue;
+    }
+    uint8_t n = 0;
+    while (p.prefix[n] != 0 && n < label[0] && tolower(p.prefix[n]) == tolower(label[1 + n])) {
+      n++;
+    }
+    if (p.prefix[n] == 0) {
+      // Keep the label, the query is gone by the time the answer is written.
+      _provided.provider = i;
+      _provided.parent = parent;
+      _provided.type = type == TYPE_ANY ? TYPE_A : type;
+      _provided.len = label[0];
+      memcpy(_provided.label, label + 1, label[0]);
+      _provided.label[label[0]] = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+void EC_MDNSResponder::writeProvidedName() {
+  writeBytes(&_provided.len, 1);
+  writeBytes(_provided.label, _provided.len);
+  writeName(_provided.parent);
+}
+
+bool EC_MDNSResponder::writeProvided(bool legacy) {
+  uint16_t len = _responseLen;
+  uint8_t written = _writtenCount;
+  writeProvidedName();
+  write16(_provided.type);
+  write16(legacy ? CLASS_IN : CLASS_IN | CACHE_FLUSH);
+  write32(legacy && _ttl > LEGACY_TTL ? LEGACY_TTL : _ttl);
+  write16(0);
+  // The provider writes its rdata straight into the response.
+  uint8_t rdlength = 0;
+  if (!_responseFull) {
+    uint16_t room = _responseSize - _responseLen;
+    rdlength = _nameProviders[_provided.provider].provider(_provided.label, _provided.len, _provided.type,
+        (uint8_t*) _response + _responseLen, room > 0xFF ? 0xFF : room);
+  }
+  if (_responseFull || rdlength == 0 || rdlength > _responseSize - _responseLen) {
+    _responseLen = len;
+    _writtenCount = written;
+    _responseFull = false;
+    return false;
+  }
+  _response[_responseLen - 1] = rdlength;
+  _responseLen += rdlength;
+  return true;
+}
+#endif
+
+#if MDNS_ENABLE_SERVICES
+uint8_t EC_MDNSResponder::addService(const char* type, const char* protocol, uint16_t port, const char* instance) {
+  return addServiceFor(_hostName, type, protocol, port, instance);
+}
+
+uint8_t EC_MDNSResponder::addServiceFor(uint8_t host, const char* type, const char* protocol, uint16_t port, const char* instance) {
+  // The instance name defaults to the host name. Copy it, the name pool may
+  // move while adding names.
+  char hostLabel[MAX_LABEL_SIZE + 1];
+  if (instance == NULL) {
+    memcpy(hostLabel, &_names[host + 2], _names[host + 1]);
+    hostLabel[_names[host + 1]] = 0;
+    instance = hostLabel;
+  }
+  size_t typeLen = strlen(type);
+  size_t protocolLen = strlen(protocol);
+  size_t instanceLen = strlen(instance);
+  if (typeLen > MAX_LABEL_SIZE || protocolLen > MAX_LABEL_SIZE || instanceLen > MAX_LABEL_SIZE) {
+    MDNS_TRACE_E("service label too long");
+    return MDNS_NO_SERVICE;
+  }
+
+  // <instance>.<type>.<protocol>.local, sharing "local" with our host name
+  uint8_t name = addName(_names[_hostName], protocol, protocolLen);
+  uint8_t serviceType = name == MDNS_NO_NAME ? MDNS_NO_NAME : addName(name, type, typeLen);
+  name = serviceType == MDNS_NO_NAME ? MDNS_NO_NAME : addName(serviceType, instance, instanceLen);
+
+  // PTR from the service type to the instance, SRV pointing at the host name
+  // and an empty TXT record (DNS-SD requires one).
+  uint8_t recordCount = _recordCount;
+  uint16_t wireLen = _wireLen;
+  uint8_t srv[6] = { 0x00, 0x00, 0x00, 0x00, (uint8_t)(port >> 8), (uint8_t)port }; // Priority, weight, port
+  uint8_t ptr = addRecord(serviceType, TYPE_PTR, CLASS_IN, NULL, 0, name, 0);
+  if (ptr == MDNS_NO_RECORD ||
+      addRecord(name, TYPE_SRV, CLASS_IN | CACHE_FLUSH, srv, sizeof(srv), host, sizeof(srv)) == MDNS_NO_RECORD ||
+      addRecord(name, TYPE_TXT, CLASS_IN | CACHE_FLUSH, (const uint8_t*) "", 1, MDNS_NO_NAME, 0) == MDNS_NO_RECORD ||
+      !addServiceType(serviceType)) {
+    _recordCount = recordCount;
+    _wireLen = wireLen;
+    MDNS_TRACE_E("out of memory for service");
+    return MDNS_NO_SERVICE;
+  }
+  return ptr;
+}
+#endif
+
+#if MDNS_ENABLE_SERVICES
+bool EC_MDNSResponder::addServiceType(uint8_t serviceType) {
+  // _services._dns-sd._udp.local has one PTR per service type we have an
+  // instance of (RFC 6763, section 9).
+  uint8_t name = addName(_names[_hostName], "_udp", 4);
+  name = name == MDNS_NO_NAME ? MDNS_NO_NAME : addName(name, "_dns-sd", 7);
+  name = name == MDNS_NO_NAME ? MDNS_NO_NAME : addName(name, "_services", 9);
+  for (uint8_t i = 0; i < _recordCount; i++) {
+    if (_records[i].name == name && _records[i].target == serviceType) {
+      return true;
+    }
+  }
+  return addRecord(name, TYPE_PTR, CLASS_IN, NULL, 0, serviceType, 0) != MDNS_NO_RECORD;
+}
+
+bool EC_MDNSResponder::addSubtype(uint8_t service, const char* subtype) {
+  size_t n = strlen(subtype);
+  if (service >= _recordCount || recordType(service) != TYPE_PTR || n == 0 || n > MAX_LABEL_SIZE) {
+    return false;
+  }
+  // <subtype>._sub.<type>.<protocol>.local, pointing at the same instance as
+  // the PTR of the service.
+  uint8_t name = addName(_records[service].name, "_sub", 4);
+  name = name == MDNS_NO_NAME ? MDNS_NO_NAME : addName(name, subtype, n);
+  if (addRecord(name, TYPE_PTR, CLASS_IN, NULL, 0, _records[service].target, 0) == MDNS_NO_RECORD) {
+    MDNS_TRACE_E("out of memory for subtype");
+    return false;
+  }
+  return true;
+}
+
+bool EC_MDNSResponder::setTxt(uint8_t service, PGM_P key, const char* value) {
+  // The TXT record follows the PTR and SRV records of the service.
+  uint8_t record = service + 2;
+  if (service >= _recordCount || record >= _recordCount || recordType(record) != TYPE_TXT) {
+    return false;
+  }
+  uint8_t entry = _txtCount;
+  for (uint8_t i = 0; i < _txtCount && entry == _txtCount; i++) {
+    PGM_P a = _txt[i].key;
+    PGM_P b = key;
+    while (pgm_read_byte(a) != 0 && pgm_read_byte(a) == pgm_read_byte(b)) {
+      a++;
+      b++;
+    }
+    if (_txt[i].record == record && pgm_read_byte(a) == pgm_read_byte(b)) {
+      entry = i;
+    }
+  }
+  bool added = entry == _txtCount;
+  if (added) {
+    if (value == NULL) {
+      return true;
+    }
+    if (_txtCount == MDNS_TXT_ENTRIES) {
+      MDNS_TRACE_E("out of TXT entries");
+      return false;
+    }
+    _txt[_txtCount].record = record;
+    _txt[_txtCount].key = key;
+    _txtCount++;
+  }
+
+  // Encode the pairs again, with the new value for key and the others taken
+  // from the record as it is.
+  const uint8_t* current = _wire + _records[record].wire + RECORD_RDATA;
+  uint8_t currentLen = _records[record].wireLen - RECORD_RDATA;
+  uint8_t currentPos = 0;
+  uint8_t txt[MDNS_MAX_TXT];
+  uint8_t len = 0;
+  for (uint8_t i = 0; i < _txtCount; i++) {
+    if (_txt[i].record != record) {
+      continue;
+    }
+    uint8_t keyLen = strlen_P(_txt[i].key);
+    const char* v;
+    size_t vLen;
+    if (i != entry || !added) {
+      // The current pair of this key, "<key>=<value>"
+      v = (const char*) current + currentPos + 1 + keyLen + 1;
+      vLen = current[currentPos] - keyLen - 1;
+      currentPos += 1 + current[currentPos];
+    }
+    if (i == entry) {
+      if (value == NULL) {
+        continue;
+      }
+      v = value;
+      vLen = strlen(value);
+    }
+    size_t n = keyLen + 1 + vLen;
+    if (n > 0xFF || len + 1 + n > MDNS_MAX_TXT) {
+      if (added) {
+        _txtCount--;
+      }
+      MDNS_TRACE_E("TXT record too long");
+      return false;
+    }
+    txt[len++] = n;
+    memcpy_P(txt + len, _txt[i].key, keyLen);
+    len += keyLen;
+    txt[len++] = '=';
+    memcpy(txt + len, v, vLen);
+    len += vLen;
+  }
+  if (len == 0) {
+    // A TXT record holds at least one string, empty if need be.
+    txt[len++] = 0;
+  }
+
+  if (len != currentLen || memcmp(txt, current, len) != 0) {
+    if (!setRdata(record, txt, len)) {
+      if (added) {
+        _txtCount--;
+      }
+      MDNS_TRACE_E("out of memory for TXT");
+      return false;
+    }
+    // Announce the new record, again if it was being announced already.
+    // Not when a provider is filling it in for a response.
+    if (!_providing) {
+      _announce |= RECORD_BIT(record);
+      _announceLeft = ANNOUNCE_COUNT;
+      _announceDue = millis();
+    }
+  }
+  if (value == NULL) {
+    _txtCount--;
+    memmove(&_txt[entry], &_txt[entry + 1], (_txtCount - entry) * sizeof(TxtEntry));
+  }
+  return true;
+}
+#endif
+
+#if MDNS_ENABLE_SERVICES
+bool EC_MDNSResponder::setTxtProvider(uint8_t service, MDNSTxtProvider provider, uint32_t interval) {
+  uint8_t record = service + 2;
+  if (service >= _recordCount || record >= _recordCount || recordType(record) != TYPE_TXT) {
+    return false;
+  }
+  uint8_t i = 0;
+  while (i < _txtProviderCount && _txtProviders[i].record != record) {
+    i++;
+  }
+  if (provider == NULL) {
+    if (i < _txtProviderCount) {
+      _txtProviders[i] = _txtProviders[--_txtProviderCount];
+    }
+    return true;
+  }
+  if (i == _txtProviderCount) {
+    if (_txtProviderCount == MDNS_TXT_PROVIDERS) {
+      MDNS_TRACE_E("out of TXT providers");
+      return false;
+    }
+    _txtProviderCount++;
+  }
+  TxtProvider& p = _txtProviders[i];
+  p.record = record;
+  p.called = false;
+  p.provider = provider;
+  p.interval = interval;
+  return true;
+}
+
+void EC_MDNSResponder::refreshTxt(MDNSRecordSet records) {
+  // Under a query storm every provider is still called once per interval.
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < _txtProviderCount; i++) {
+    TxtProvider& p = _txtProviders[i];
+    if (!(records & RECORD_BIT(p.record)) || (p.called && (int32_t)(now - p.expires) < 0)) {
+      continue;
+    }
+    p.called = true;
+    p.expires = now + p.interval;
+    _providing = true;
+    p.provider(p.record - 2);
+    _providing = false;
+  }
+}
+#endif
+
+#if MDNS_ENABLE_STATS
+void EC_MDNSResponder::resetStats() {
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+void EC_MDNSResponder::countQuestion(uint16_t type) {
+  switch (type) {
+    case TYPE_A:    _stats.questions[MDNS_QTYPE_A]++; break;
+    case TYPE_AAAA: _stats.questions[MDNS_QTYPE_AAAA]++; break;
+    case TYPE_ANY:  _stats.questions[MDNS_QTYPE_ANY]++; break;
+    default:        _stats.questions[MDNS_QTYPE_OTHER]++; break;
+  }
+}
+#endif
+
+EC_MDNSResponder mdns;
+
+#if MDNS_ENABLE_LATENCY
+void EC_MDNSResponder::resetLatency() {
+  memset(&_latency, 0, sizeof(_latency));
+}
+
+void EC_MDNSResponder::recordLatency() {
+  for (uint8_t stage = 0; stage < MDNS_STAGE_COUNT; stage++) {
+    uint32_t t;
+    if (stage == MDNS_STAGE_TOTAL) {
+      t = (MDNS_LATENCY_TYPE)(_stamps[MDNS_STAMP_SENT] - _stamps[MDNS_STAMP_ENTRY]);
+    } else {
+      t = (MDNS_LATENCY_TYPE)(_stamps[stage + 1] - _stamps[stage]);
+    }
+    EC_MDNSLatencyStage& s = _latency.stages[stage];
+    if (_latency.count == 0 || t < s.min) {
+      s.min = t;
+    }
+    if (t > s.max) {
+      s.max = t;
+    }
+    s.total += t;
+
+    if (stage == MDNS_STAGE_TOTAL) {
+      // Bucket is the index of the highest bit set in t.
+      uint8_t bucket = 0;
+      while (t > 1 && bucket < MDNS_LATENCY_BUCKETS - 1) {
+        t >>= 1;
+        bucket++;
+      }
+      if (_latency.histogram[bucket] != 0xFFFF) {
+        _latency.histogram[bucket]++;
+      }
+    }
+  }
+  _latency.count++;
+}
+#endif
+
+#if MDNS_ENABLE_CAPTURE
+void EC_MDNSResponder::capturePacket(const uint8_t* src_ip, const char* data, uint16_t len, uint8_t decision) {
+  EC_MDNSCaptureEntry& e = _capture[_captureNext];
+  e.time = millis();
+  memcpy(e.srcIp, src_ip, 4);
+  e.len = len;
+  e.decision = decision;
+  memcpy(e.data, data, len < MDNS_CAPTURE_BYTES ? len : MDNS_CAPTURE_BYTES);
+
+  _captureNext = (_captureNext + 1) % MDNS_CAPTURE_ENTRIES;
+  if (_captureCount < MDNS_CAPTURE_ENTRIES) {
+    _captureCount++;
+  }
+}
+
+const EC_MDNSCaptureEntry* EC_MDNSResponder::getCapture(uint8_t index) {
+  if (index >= _captureCount) {
+    return NULL;
+  }
+  // The oldest entry is the one that will be overwritten next.
+  uint8_t first = _captureCount < MDNS_CAPTURE_ENTRIES ? 0 : _captureNext;
+  return &_capture[(first + index) % MDNS_CAPTURE_ENTRIES];
+}
+
+void EC_MDNSResponder::dumpCapture(Print& out) {
+  for (uint8_t i = 0; i < _captureCount; i++) {
+    const EC_MDNSCaptureEntry* e = getCapture(i);
+
+    // Comment line: text2pcap skips it, people read it.
+    out.print(F("# t="));
+    out.print(e->time);
+    out.print(F(" src="));
+    for (uint8_t j = 0; j < 4; j++) {
+      out.print(e->srcIp[j]);
+      if (j < 3) {
+        out.print('.');
+      }
+    }
+    out.print(F(" len="));
+    out.print(e->len);
+    out.print(F(" decision="));
+    out.println(e->decision);
+
+    // Hex dump with offsets, 16 bytes per line.
+    uint16_t n = e->len < MDNS_CAPTURE_BYTES ? e->len : MDNS_CAPTURE_BYTES;
+    for (uint16_t j = 0; j < n; j++) {
+      if (j % 16 == 0) {
+        if (j > 0) {
+          out.println();
+        }
+        for (uint16_t digit = 0x1000; digit > 0; digit >>= 4) {
+          out.print((j / digit) & 0x0F, HEX);
+        }
+        out.print(' ');
+      }
+      out.print(' ');
+      if (e->data[j] < 0x10) {
+        out.print('0');
+      }
+      out.print(e->data[j], HEX);
+    }
+    out.println();
+  }
+}
+#endif
+
+#if MDNS_ENABLE_TOPTALKERS
+EC_MDNSTalker* EC_MDNSResponder::countTalker(const uint8_t* ip) {
+  // Halve all counts once per window that passed, so they follow the rate.
+  uint32_t now = millis();
+  uint8_t shift = 0;
+  while (now - _talkersDecayed >= MDNS_TOPTALKER_WINDOW && shift < 16) {
+    _talkersDecayed += MDNS_TOPTALKER_WINDOW;
+    shift++;
+  }
+  if (shift == 16) {
+    _talkersDecayed = now;
+  }
+
+  // Space-Saving: count the host if it is tracked, otherwise take over the
+  // slot with the lowest count and inherit that count as error.
+  EC_MDNSTalker* found = NULL;
+  EC_MDNSTalker* lowest = &_talkers[0];
+  for (uint8_t i = 0; i < MDNS_TOPTALKER_COUNTERS; i++) {
+    EC_MDNSTalker* t = &_talkers[i];
+    if (shift > 0) {
+      t->count >>= shift;
+      t->error >>= shift;
+    }
+    if (found == NULL && t->count > 0 && memcmp(t->ip, ip, 4) == 0) {
+      found = t;
+    }
+    if (t->count < lowest->count) {
+      lowest = t;
+    }
+  }
+  if (found == NULL) {
+    found = lowest;
+    memcpy(found->ip, ip, 4);
+    found->error = found->count;
+  }
+  if (found->count != 0xFFFF) {
+    found->count++;
+  }
+  return found;
+}
+
+uint8_t EC_MDNSResponder::getTopTalkers(EC_MDNSTalker* talkers, uint8_t max) {
+  // A steady rate r per ms gives a count of r * (window + time since the
+  // last halving).
+  uint32_t span = MDNS_TOPTALKER_WINDOW + (millis() - _talkersDecayed);
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < MDNS_TOPTALKER_COUNTERS; i++) {
+    const EC_MDNSTalker& t = _talkers[i];
+    if (t.count == 0) {
+      continue;
+    }
+    // Insertion sort into the output, busiest first.
+    uint8_t j = n < max ? n++ : max;
+    while (j > 0 && talkers[j - 1].count < t.count) {
+      if (j < max) {
+        talkers[j] = talkers[j - 1];
+      }
+      j--;
+    }
+    if (j < max) {
+      talkers[j] = t;
+      talkers[j].perSecond = (uint32_t)t.count * 1000 / span;
+    }
+  }
+  return n;
+}
+#endif
+
+#if MDNS_TRACE_LEVEL > 0
+void EC_MDNSResponder::trace(uint8_t level, PGM_P format, ...) {
+  if (_traceSink == NULL) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  _traceSink(level, format, args);
+  va_end(args);
+}
+
+void EC_MDNSResponder::traceToSerial(uint8_t level, PGM_P format, va_list args) {
+  char line[64];
+  vsnprintf_P(line, sizeof(line), format, args);
+  Serial.print(F("mdns "));
+  Serial.print(level);
+  Serial.print(F(": "));
+  Serial.println(line);
+}
+#endif
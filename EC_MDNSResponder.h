@@ -8,8 +8,9 @@
  * created by Tony DiCola <tony@tonydicola.com>.
  *
  * This is a simple implementation of multicast DNS query support for an Arduino
- * and ENC28J60 ethernet module. Only support for resolving address queries is
- * currently implemented.
+ * and ENC28J60 ethernet module. It answers address queries for its host name
+ * and, with MDNS_ENABLE_SERVICES, advertises DNS-SD services (PTR, SRV and TXT
+ * records).
  *
  * Requirements:
  * - EtherCard (with UDP enhancements): https://github.com/itavero/ethercard/tree/enhancements
@@ -44,36 +45,533 @@
 #endif
 
 #include "EtherCard.h"
+#include "EC_MDNSConfig.h"
+
+// Reasons for not answering a received packet
+enum {
+	MDNS_REJECT_SHORT,   // Shorter than a DNS header
+	MDNS_REJECT_HEADER,  // Not a standard query (response, opcode or rcode set)
+	MDNS_REJECT_NAME,    // No question is for one of our records
+	MDNS_REJECT_MALFORMED, // Question runs past the end, loops or chains too many pointers
+	MDNS_REJECT_RATE,    // Sender is over MDNS_TOPTALKER_LIMIT
+	MDNS_REJECT_KNOWN,   // Querier listed all answers as known
+	MDNS_REJECT_COUNT
+};
+
+// Decision recorded for a captured packet: one of the reject reasons or these
+#define MDNS_ANSWERED MDNS_REJECT_COUNT
+#define MDNS_DEFERRED (MDNS_REJECT_COUNT + 1)  // Answer waits for more known answers
+
+// Question types counted separately
+enum {
+	MDNS_QTYPE_A,
+	MDNS_QTYPE_AAAA,
+	MDNS_QTYPE_ANY,
+	MDNS_QTYPE_OTHER,
+	MDNS_QTYPE_COUNT
+};
+
+#if MDNS_ENABLE_STATS
+struct EC_MDNSStats {
+	uint32_t packets;                      // Packets handed to onUdpReceive
+	uint32_t bytesScanned;                 // Payload bytes examined by the parser
+	uint32_t rejects[MDNS_REJECT_COUNT];   // Packets not answered, by reason
+	uint32_t questions[MDNS_QTYPE_COUNT];  // Questions for our name, by type
+	uint32_t answersSent;                  // Response packets handed to EtherCard
+	uint32_t answersSuppressed;            // Records left out as known to the querier
+	uint32_t queriesDeferred;              // Truncated queries answered from poll()
+};
+#endif
+
+#if MDNS_ENABLE_LATENCY
+// Points in the life of an answered query that get a timestamp
+enum {
+	MDNS_STAMP_ENTRY,     // onUdpReceive() entered
+	MDNS_STAMP_MATCH,     // Question matched our name
+	MDNS_STAMP_BUILD,     // Response ready to send
+	MDNS_STAMP_SENT,      // EtherCard returned from transmitting
+	MDNS_STAMP_COUNT
+};
+
+// Intervals between consecutive stamps, plus the total
+enum {
+	MDNS_STAGE_PARSE,     // Entry to match
+	MDNS_STAGE_BUILD,     // Match to build
+	MDNS_STAGE_SEND,      // Build to sent
+	MDNS_STAGE_TOTAL,     // Entry to sent
+	MDNS_STAGE_COUNT
+};
+
+#define MDNS_LATENCY_BUCKETS 16
+
+struct EC_MDNSLatencyStage {
+	uint32_t min;         // In MDNS_LATENCY_CLOCK ticks
+	uint32_t max;
+	uint32_t total;       // Divide by count for the average
+};
+
+struct EC_MDNSLatency {
+	uint32_t count;                                 // Answered queries traced
+	EC_MDNSLatencyStage stages[MDNS_STAGE_COUNT];
+	// Total latency, bucket n holds [2^n, 2^(n+1)) ticks (bucket 0 also
+	// holds 0), the last bucket everything above. Counts saturate.
+	uint16_t histogram[MDNS_LATENCY_BUCKETS];
+};
+#endif
+
+#if MDNS_ENABLE_CAPTURE
+struct EC_MDNSCaptureEntry {
+	uint32_t time;                     // millis() when received
+	uint8_t srcIp[4];
+	uint16_t len;                      // Full payload length
+	uint8_t decision;                  // MDNS_ANSWERED, MDNS_DEFERRED or MDNS_REJECT_*
+	uint8_t data[MDNS_CAPTURE_BYTES];  // Start of the payload
+};
+#endif
+
+#if MDNS_TRACE_LEVEL > 0
+#include <stdarg.h>
+
+// Receives the trace level, a printf style format in flash and its arguments
+typedef void (*MDNSTraceSink)(uint8_t level, PGM_P format, va_list args);
+#endif
+
+#if MDNS_ENABLE_TOPTALKERS
+struct EC_MDNSTalker {
+	uint8_t ip[4];
+	uint16_t count;       // Decayed packet count, may overestimate by error
+	uint16_t error;
+	uint16_t perSecond;   // Estimated packets per second (set by getTopTalkers)
+};
+#endif
+
+// Reference to no entry of the name pool (the root of all names)
+#define MDNS_NO_NAME 0xFF
+#define MDNS_NO_RECORD 0xFF
+#define MDNS_NO_SERVICE 0xFF
+#define MDNS_NO_PROXY 0xFF
+
+// A set of records, one bit per record followed by one per proxy host
+#if MDNS_MAX_RECORDS + MDNS_PROXY_HOSTS <= 8
+typedef uint8_t MDNSRecordSet;
+#elif MDNS_MAX_RECORDS + MDNS_PROXY_HOSTS <= 16
+typedef uint16_t MDNSRecordSet;
+#else
+typedef uint32_t MDNSRecordSet;
+#endif
+
+#if MDNS_NAME_PROVIDERS > 0
+// Writes the rdata of the record of the given type for the name made of label
+// and the parent of the provider, at most max bytes. Returns its length, or 0
+// if there is no such record.
+typedef uint8_t (*MDNSNameProvider)(const char* label, uint8_t len, uint16_t type, uint8_t* rdata, uint8_t max);
+#endif
+
+#if MDNS_ENABLE_SERVICES
+// Fills in the TXT record of a service with setTxt()
+typedef void (*MDNSTxtProvider)(uint8_t service);
+#endif
 
 class EC_MDNSResponder {
 	public:
 		static bool begin(const char* domain, EtherCard& ether, uint32_t ttlSeconds = 3600);
+#if MDNS_ENABLE_SERVICES
+		// Advertise a DNS-SD service such as ("_http", "_tcp", 80) on our host
+		// name. The instance name defaults to the host name. Call after begin().
+		// Returns a handle to the service, or MDNS_NO_SERVICE when out of memory
+		// or records.
+		static uint8_t addService(const char* type, const char* protocol, uint16_t port, const char* instance = NULL);
+		// Make a service show up when browsing for a subtype such as "_printer"
+		// (_printer._sub._http._tcp.local). Returns false when out of memory or
+		// records.
+		static bool addSubtype(uint8_t service, const char* subtype);
+		// Set key=value in the TXT record of a service, or remove the key when
+		// value is NULL. The key is kept in flash (use PSTR()), the value is
+		// copied into the record. When the record changes it is announced
+		// from poll(). Returns false when out of entries or space.
+		static bool setTxt(uint8_t service, PGM_P key, const char* value);
+		// Have provider called when the TXT record of a service is about to be
+		// sent and it was last called more than interval ms ago, or never.
+		// Changes it makes go out with that response and are not announced.
+		// A NULL provider removes it.
+		static bool setTxtProvider(uint8_t service, MDNSTxtProvider provider, uint32_t interval);
+#endif
+#if MDNS_NAME_PROVIDERS > 0
+		// Have provider answer questions for names of one label starting with
+		// prefix below parent, e.g. ("sensor-", "local") for sensor-01.local.
+		// Queries for ANY ask for an A record. prefix is not copied.
+		static bool addNameProvider(const char* prefix, const char* parent, MDNSNameProvider provider);
+#endif
+#if MDNS_PROXY_HOSTS > 0
+		// Answer address queries for a host without mDNS, e.g. ("plc-3",
+		// {10, 0, 4, 3}) for plc-3.local, with its own TTL. Returns a handle,
+		// or MDNS_NO_PROXY when out of entries or memory.
+		static uint8_t addProxyHost(const char* name, const uint8_t ip[4], uint16_t ttlSeconds = 120);
+#if MDNS_ENABLE_SERVICES
+		// Like addService(), for a service running on a proxy host
+		static uint8_t addProxyService(uint8_t host, const char* type, const char* protocol, uint16_t port, const char* instance = NULL);
+#endif
+#endif
+#if MDNS_ENABLE_UNICAST_DNS
+		// Answer DNS queries on port 53 for names in zone (e.g. "lab.example.com")
+		// as for the same names in .local. Anything outside it is refused.
+		// Call after begin().
+		static bool setDnsZone(const char* zone);
+#endif
 		// Callback
 		static void onUdpReceive(uint8_t dest_ip[4], uint16_t dest_port, uint8_t src_ip[4], const char *data, uint16_t len);
+#if MDNS_ENABLE_UNICAST_DNS
+		static void onDnsReceive(uint8_t dest_ip[4], uint16_t dest_port, uint8_t src_ip[4], const char *data, uint16_t len);
+#endif
+#if MDNS_ENABLE_LLMNR
+		static void onLlmnrReceive(uint8_t dest_ip[4], uint16_t dest_port, uint8_t src_ip[4], const char *data, uint16_t len);
+#endif
+#if MDNS_ENABLE_NBNS
+		static void onNbnsReceive(uint8_t dest_ip[4], uint16_t dest_port, uint8_t src_ip[4], const char *data, uint16_t len);
+#endif
+		// Send answers that were held back. Call from loop(), outside of
+		// packetLoop(), as it builds packets in Ethernet::buffer.
+		static void poll();
+
+#if MDNS_ENABLE_STATS
+		static const EC_MDNSStats& getStats() { return _stats; }
+		static void resetStats();
+#endif
+#if MDNS_ENABLE_LATENCY
+		static const EC_MDNSLatency& getLatency() { return _latency; }
+		static void resetLatency();
+#endif
+#if MDNS_ENABLE_TOPTALKERS
+		// Copy up to max of the busiest hosts to talkers, busiest first.
+		// Returns the number copied.
+		static uint8_t getTopTalkers(EC_MDNSTalker* talkers, uint8_t max);
+#endif
+#if MDNS_TRACE_LEVEL > 0
+		static void setTraceSink(MDNSTraceSink sink) { _traceSink = sink; }
+		// Sink printing every message on its own line to Serial
+		static void traceToSerial(uint8_t level, PGM_P format, va_list args);
+		// Used by the MDNS_TRACE_* macros below
+		static void trace(uint8_t level, PGM_P format, ...);
+#endif
+#if MDNS_ENABLE_CAPTURE
+		// Captured packets, 0 being the oldest. NULL when out of range.
+		static const EC_MDNSCaptureEntry* getCapture(uint8_t index);
+		static uint8_t captureCount() { return _captureCount; }
+		// Print the capture as a hex dump that text2pcap understands
+		// (text2pcap -u 5353,5353 dump.txt dump.pcap).
+		static void dumpCapture(Print& out);
+#endif
 
 	private:
 	
 		static EtherCard etherCard;
+
+#if MDNS_ENABLE_STATS
+		static EC_MDNSStats _stats;
+#endif
+#if MDNS_ENABLE_LATENCY
+		static EC_MDNSLatency _latency;
+		static MDNS_LATENCY_TYPE _stamps[MDNS_STAMP_COUNT];
+#endif
+#if MDNS_ENABLE_TOPTALKERS
+		static EC_MDNSTalker _talkers[MDNS_TOPTALKER_COUNTERS];
+		static uint32_t _talkersDecayed;
+#endif
+#if MDNS_TRACE_LEVEL > 0
+		static MDNSTraceSink _traceSink;
+#endif
+#if MDNS_ENABLE_CAPTURE
+		static EC_MDNSCaptureEntry _capture[MDNS_CAPTURE_ENTRIES];
+		static uint8_t _captureNext;
+		static uint8_t _captureCount;
+#endif
 	
-		// Expected query values
-		static uint8_t _queryHeader[];
-		static uint8_t* _queryFQDN;
-		static int _queryFQDNLen;
-
-		// Current parsing state
-		static uint8_t* _current;
-		static int _currentLen;
-		static int _index;
-		static uint8_t _FQDNcount;
-
-		// Response data
+		// Names we answer for, stored once per distinct label as a tree in a
+		// single array: every entry is <parent entry>, <label length>, <label>
+		// and is referred to by its offset. "local" is shared by all names.
+		// Without the record store only our name, as it is written in a
+		// response.
+		static uint8_t* _names;
+		static uint8_t _namesLen;
+#if MDNS_RECORD_STORE
+		static uint8_t _hostName;
+#endif
+		static uint32_t _ttl;
+#if MDNS_ENABLE_UNICAST_DNS
+		// While a DNS query is handled, names in _zone are read and written as
+		// the same names in .local.
+		static uint8_t _zone;
+		static bool _unicast;
+		static bool _inZone;   // Set by parseName()
+#endif
+#if MDNS_ENABLE_LLMNR
+		static bool _llmnr;    // Names are read and written without .local
+#endif
+#if MDNS_ENABLE_DISCOVERY_PROXY
+		static uint8_t _zoneLabels;
+		// Names below are uncompressed labels up to a 0, without .local or the
+		// zone. An empty name marks a free entry.
+		struct CachedAnswer {
+			uint8_t name[MDNS_PROXY_NAME];
+			uint16_t type;
+			uint8_t rdlength;      // 0: the name has no data of this type
+			uint8_t rdata[16];
+			uint32_t expires;      // millis()
+		};
+		static CachedAnswer _cache[MDNS_PROXY_CACHE];
+		// DNS query waiting for an mDNS answer
+		struct Lookup {
+			uint8_t name[MDNS_PROXY_NAME];
+			uint32_t zoneCase;     // See proxyLookup()
+			uint16_t type;
+			uint16_t id;
+			uint16_t flags;        // Of the response
+			uint8_t ip[4];
+			uint8_t mac[6];        // Next hop towards the client
+			uint16_t port;
+			uint32_t due;          // millis() to give up at
+		};
+		static Lookup _lookups[MDNS_PROXY_LOOKUPS];
+#endif
+
+		// A record we answer with. Everything except its names is kept encoded
+		// in _wire (type, class, TTL, rdlength and rdata), ready to be copied
+		// into a response. The owner name and the name inside the rdata (e.g.
+		// the target of a PTR or SRV) are written per response, so they can be
+		// compressed against what is already in it.
+		struct Record {
+			uint8_t name;       // Owner, entry in the name pool
+			uint8_t target;     // Name in the rdata, MDNS_NO_NAME if none
+			uint8_t targetAt;   // Rdata bytes before target
+			uint8_t wireLen;
+			uint16_t wire;      // Offset of the encoded part in _wire
+		};
+#if MDNS_RECORD_STORE
+		static Record _records[MDNS_MAX_RECORDS];
+		static uint8_t _recordCount;
+		static uint8_t* _wire;
+		static uint16_t _wireLen;
+#endif
+
+#if MDNS_PROXY_HOSTS > 0
+		// Address records of other hosts. They are set 1 << (MDNS_MAX_RECORDS
+		// + index) in a record set.
+		struct ProxyHost {
+			uint8_t name;
+			uint8_t ip[4];
+			uint16_t ttl;
+		};
+		static ProxyHost _proxies[MDNS_PROXY_HOSTS];
+		static uint8_t _proxyCount;
+#endif
+
+#if MDNS_ENABLE_SERVICES
+		// TXT keys in flash, in the order of their pairs in the TXT records
+		struct TxtEntry {
+			uint8_t record;
+			PGM_P key;
+		};
+		static TxtEntry _txt[MDNS_TXT_ENTRIES];
+		static uint8_t _txtCount;
+		// Records announced from poll() after they changed
+		static MDNSRecordSet _announce;
+		static uint8_t _announceLeft;
+		static uint32_t _announceDue;
+		struct TxtProvider {
+			uint8_t record;
+			bool called;
+			MDNSTxtProvider provider;
+			uint32_t interval;
+			uint32_t expires;     // millis() after which to call it again
+		};
+		static TxtProvider _txtProviders[MDNS_TXT_PROVIDERS];
+		static uint8_t _txtProviderCount;
+		static bool _providing;
+#endif
+
+		// Response being built
 		static char* _response;
-		static int _responseLen;
+		static uint16_t _responseSize;
+		static uint16_t _responseLen;
+		static bool _responseFull;
+#if MDNS_RECORD_STORE
+		// Names already in the response and where, for compression
+		static uint8_t _writtenNames[MDNS_COMPRESSION_ENTRIES];
+		static uint16_t _writtenAt[MDNS_COMPRESSION_ENTRIES];
+		static uint8_t _writtenCount;
+#else
+		static uint16_t _nameAt;   // Of our name in the response, 0 if not in it
+#endif
+
+#if MDNS_NAME_PROVIDERS > 0
+		struct NameProvider {
+			const char* prefix;
+			uint8_t parent;
+			MDNSNameProvider provider;
+		};
+		static NameProvider _nameProviders[MDNS_NAME_PROVIDERS];
+		static uint8_t _nameProviderCount;
+		// The question of the packet being answered that goes to a provider.
+		// Only one per packet.
+		struct ProvidedQuestion {
+			uint8_t provider;        // MDNS_NAME_PROVIDERS if none
+			uint8_t parent;
+			uint16_t type;
+			uint8_t len;
+			char label[64];          // Up to 63 characters and a terminating 0
+		};
+		static ProvidedQuestion _provided;
+#endif
+
+#if MDNS_DEFERRED_QUERIES > 0
+		// Answers to a truncated query, waiting for the rest of its known answers
+		struct Deferred {
+			uint8_t ip[4];
+			uint32_t due;            // millis() to answer at
+			MDNSRecordSet answers;   // None when the entry is free
+		};
+		static Deferred _deferred[MDNS_DEFERRED_QUERIES];
+#endif
 
-		static void changeState(uint8_t* state);
-		static void sendResponse();
+#if MDNS_RECORD_STORE
+		static uint8_t addName(uint8_t parent, const char* label, uint8_t len);
+		// Add a name such as "bus.local", returns its entry or MDNS_NO_NAME
+		static uint8_t addNames(const char* name);
+		static uint8_t findName(uint8_t parent, const uint8_t* label, uint8_t len);
+#endif
+		// Read the name at pos, set node to the entry it equals (MDNS_NO_NAME if
+		// none) and return the offset after it, or 0 if it is malformed. When
+		// only its first label is unknown, label is set to where that is and
+		// parent to the entry of the rest. Without the record store node is 0
+		// for our name.
+		static uint16_t parseName(const uint8_t* msg, uint16_t len, uint16_t pos, uint8_t* node, uint16_t* label = NULL, uint8_t* parent = NULL);
+		static uint16_t skipName(const uint8_t* msg, uint16_t len, uint16_t pos);
+		static void writeBytes(const void* bytes, uint16_t len);
+		static void write16(uint16_t value);
+		static void write32(uint32_t value);
+#if MDNS_RECORD_STORE
+		static void writeName(uint8_t node);
+		static uint8_t addRecord(uint8_t name, uint16_t type, uint16_t cls, const uint8_t* rdata, uint8_t rdlength, uint8_t target, uint8_t targetAt);
+#if MDNS_ENABLE_SERVICES
+		static bool setRdata(uint8_t index, const uint8_t* rdata, uint8_t rdlength);
+#endif
+		static bool reserveResponse();
+		static uint16_t recordType(uint8_t index);
+#else
+		static void writeHostName();
+#endif
+		static MDNSRecordSet matchRecords(uint8_t name, uint16_t type);
+		static MDNSRecordSet additionalRecords(MDNSRecordSet answers);
+		static uint8_t countRecords(MDNSRecordSet records);
+#if MDNS_ENABLE_SERVICES
+		static uint8_t addServiceFor(uint8_t host, const char* type, const char* protocol, uint16_t port, const char* instance);
+		static bool addServiceType(uint8_t serviceType);
+#endif
+#if MDNS_ENABLE_KNOWN_ANSWERS
+		// Read the known answers at pos and return those of our records the
+		// querier still has for at least half their TTL.
+		static MDNSRecordSet parseKnownAnswers(const uint8_t* msg, uint16_t len, uint16_t* pos);
+		static bool sameRdata(uint8_t index, const uint8_t* msg, uint16_t pos, uint16_t rdlength);
+#endif
+		// What an answer to a legacy unicast query has to repeat, and how
+		struct LegacyQuery {
+			uint16_t id;
+			uint16_t flags;     // Of the response
+			uint16_t port;      // To reply from
+			uint8_t name;
+			uint16_t type;
+			uint16_t cls;
+#if MDNS_ENABLE_UNICAST_DNS || MDNS_ENABLE_LLMNR
+			// Question section to repeat byte for byte, NULL to write name, type
+			// and class instead
+			const uint8_t* question;
+			uint16_t questionLen;
+#endif
+		};
+		static void writeRecord(uint8_t index, bool legacy);
+#if MDNS_PROXY_HOSTS > 0
+		static void writeProxy(uint8_t proxy, bool legacy);
+#endif
+#if MDNS_RECORD_STORE
+		static bool tryWriteRecord(uint8_t index, bool legacy);
+#if MDNS_ENABLE_UNICAST_DNS || MDNS_ENABLE_LLMNR
+		static void writeQuestion(const LegacyQuery* legacy);
+#endif
+		static void rearmReply();
+		static void sendTo(const uint8_t* ip, uint16_t sport, uint16_t dport, const uint8_t* mac = NULL);
+#endif
+#if MDNS_ENABLE_UNICAST_DNS || MDNS_ENABLE_LLMNR
+		static void sendDnsError(uint16_t id, uint16_t flags, const uint8_t* question, uint16_t len, uint16_t port);
+#endif
+#if MDNS_ENABLE_DISCOVERY_PROXY
+		// Copy the name at pos as uncompressed labels, return the offset after
+		// it or 0 if it is malformed or longer than size.
+		static uint16_t readName(const uint8_t* msg, uint16_t len, uint16_t pos, uint8_t* name, uint8_t size);
+		static uint8_t countLabels(const uint8_t* name);
+		static uint8_t* labelAt(uint8_t* name, uint8_t index);
+		static bool sameName(const uint8_t* a, const uint8_t* b);
+		// zoneCase has a bit set for every byte of the zone, up to the 32nd,
+		// that the query had in the other case.
+		static void proxyLookup(const uint8_t* name, uint32_t zoneCase, uint16_t type, uint16_t id, uint16_t flags, const uint8_t* ip, uint16_t port);
+		static uint8_t writeProxyReply(const uint8_t* name, uint32_t zoneCase, uint16_t type, uint16_t id, uint16_t flags);
+		// Whether the cache can answer for name and type (TYPE_ANY: whether it
+		// knows the name at all).
+		static bool isCached(const uint8_t* name, uint16_t type);
+		static void cacheResponse(const uint8_t* msg, uint16_t len);
+		static void cacheAnswer(const uint8_t* name, uint16_t type, uint32_t ttl, const uint8_t* rdata, uint8_t rdlength);
+		static void answerLookups();
+#endif
+#if MDNS_NAME_PROVIDERS > 0
+		static bool matchProvider(const uint8_t* label, uint8_t parent, uint16_t type);
+		static void writeProvidedName();
+		static bool writeProvided(bool legacy);
+#endif
+#if MDNS_ENABLE_SERVICES
+		static void refreshTxt(MDNSRecordSet records);
+#endif
+		// Returns whether any packet was sent
+		static bool sendResponse(MDNSRecordSet answers, MDNSRecordSet additional, const LegacyQuery* legacy, bool multicast);
+#if MDNS_DEFERRED_QUERIES > 0
+		static Deferred* findDeferred(const uint8_t* ip);
+		static bool deferAnswers(const uint8_t* ip, MDNSRecordSet answers);
+#endif
+#if MDNS_ENABLE_STATS
+		static void countQuestion(uint16_t type);
+#endif
+#if MDNS_ENABLE_LATENCY
+		static void recordLatency();
+#endif
+#if MDNS_ENABLE_TOPTALKERS
+		static EC_MDNSTalker* countTalker(const uint8_t* ip);
+#endif
+#if MDNS_ENABLE_CAPTURE
+		static void capturePacket(const uint8_t* src_ip, const char* data, uint16_t len, uint8_t decision);
+#endif
 };
 
 extern EC_MDNSResponder mdns;
 
+// Trace macros, format strings are put in flash by PSTR(). Each of them
+// compiles to nothing when MDNS_TRACE_LEVEL is below its level.
+#if MDNS_TRACE_LEVEL >= MDNS_TRACE_ERROR
+  #define MDNS_TRACE_E(format, ...) EC_MDNSResponder::trace(MDNS_TRACE_ERROR, PSTR(format), ##__VA_ARGS__)
+#else
+  #define MDNS_TRACE_E(format, ...) do {} while (0)
+#endif
+#if MDNS_TRACE_LEVEL >= MDNS_TRACE_WARN
+  #define MDNS_TRACE_W(format, ...) EC_MDNSResponder::trace(MDNS_TRACE_WARN, PSTR(format), ##__VA_ARGS__)
+#else
+  #define MDNS_TRACE_W(format, ...) do {} while (0)
+#endif
+#if MDNS_TRACE_LEVEL >= MDNS_TRACE_INFO
+  #define MDNS_TRACE_I(format, ...) EC_MDNSResponder::trace(MDNS_TRACE_INFO, PSTR(format), ##__VA_ARGS__)
+#else
+  #define MDNS_TRACE_I(format, ...) do {} while (0)
+#endif
+#if MDNS_TRACE_LEVEL >= MDNS_TRACE_DEBUG
+  #define MDNS_TRACE_D(format, ...) EC_MDNSResponder::trace(MDNS_TRACE_DEBUG, PSTR(format), ##__VA_ARGS__)
+#else
+  #define MDNS_TRACE_D(format, ...) do {} while (0)
+#endif
+
 #endif
\ No newline at end of file
@@ -71,4 +71,6 @@ void loop(){
     memcpy_P(ether.tcpOffset(), page, sizeof page);
     ether.httpServerReply(sizeof page - 1);
   }
+  // send MDNS answers that were held back
+  mdns.poll();
 }
\ No newline at end of file
@@ -0,0 +1,170 @@
+// 2011-01-30 <jc@wippler.nl> http://opensource.org/licenses/mit-license.php
+// 2013-11-03 Arno Moonen <info@arnom.nl>
+//
+// backSoonMDNS with measurements of how much the MDNS responder holds up the
+// HTTP replies it shares Ethernet::buffer and packetLoop() with. Point `ab`
+// or `wrk` at the board, flood it with queries for MDNS_NAME.local from
+// another host (e.g. extras/host/loadgen -t <board ip>) and compare the
+// reports with and without the storm.
+//
+// An HTTP request's latency is counted from the last time loop() found the
+// receive buffer empty, which is before the request arrived, to the reply
+// being handed to the controller. It includes the time the request spent
+// queued behind MDNS traffic. While the storm keeps the buffer from running
+// empty it is overstated by up to all the time since it last did, so take
+// the avg as a bound once MDNS frames are dropped. Frames the controller
+// dropped because its buffer was full are not seen: EtherCard does not
+// expose the count. extras/host/cotenancy runs this sketch in a simulation
+// that counts them and times every request from its arrival.
+//
+// Build with -DMDNS_ENABLE_STATS=1 to have the answers sent reported too.
+
+#include <EtherCard.h>
+#include <EC_MDNSResponder.h>
+
+#define MDNS_NAME "arduino"
+#define ETHER_CS_PIN 10
+#define STATIC 0  // set to 1 to disable DHCP (adjust myip/gwip values below)
+#define REPORT_INTERVAL 5000 // ms between reports on the serial port
+
+#if STATIC
+// ethernet interface ip address
+static byte myip[] = { 192,168,1,200 };
+// gateway ip address
+static byte gwip[] = { 192,168,1,1 };
+#endif
+
+// ethernet mac address - must be unique on your network
+static byte mymac[] = { 0x74,0x69,0x69,0x2D,0x30,0x31 };
+
+byte Ethernet::buffer[500]; // tcp/ip send and receive buffer
+
+char page[] PROGMEM =
+"HTTP/1.0 503 Service Unavailable\r\n"
+"Content-Type: text/plain\r\n"
+"Retry-After: 600\r\n"
+"\r\n"
+"Back soon\r\n"
+;
+
+// Frames of one kind in the current report interval
+struct Timing {
+  uint32_t count;
+  uint32_t total;  // us
+  uint32_t max;    // us
+};
+
+static Timing http;      // request received until reply sent, queueing included
+static Timing httpWork;  // the same without queueing
+static Timing mdnsWork;  // frames to port 5353 in packetLoop()
+static Timing otherWork; // everything else in packetLoop() (ARP, TCP handshakes, ...)
+static uint32_t pollTotal;  // us spent in mdns.poll()
+static uint32_t idleSince;  // micros() when the receive buffer was last empty
+static uint32_t lastReport;
+#if MDNS_ENABLE_STATS
+static uint32_t lastAnswers;
+#endif
+
+static void add(Timing& t, uint32_t us) {
+  t.count++;
+  t.total += us;
+  if (us > t.max) t.max = us;
+}
+
+static bool isMdns() {
+  const byte* b = Ethernet::buffer;
+  return b[ETH_TYPE_H_P] == ETH_TYPE_IP_H_V && b[ETH_TYPE_L_P] == ETH_TYPE_IP_L_V
+      && b[IP_PROTO_P] == IP_PROTO_UDP_V
+      && b[UDP_DST_PORT_H_P] == (5353 >> 8) && b[UDP_DST_PORT_L_P] == (5353 & 0xff);
+}
+
+void setup(){
+  Serial.begin(57600);
+  Serial.println("\n[backSoonMDNSLoad]");
+
+  if (ether.begin(sizeof Ethernet::buffer, mymac, ETHER_CS_PIN) == 0)
+    Serial.println( "Failed to access Ethernet controller");
+#if STATIC
+  ether.staticSetup(myip, gwip);
+#else
+  if (!ether.dhcpSetup())
+    Serial.println("DHCP failed");
+#endif
+
+  ether.printIp("IP:  ", ether.myip);
+
+  // Register MDNSResponder
+  if(!mdns.begin(MDNS_NAME, ether)) {
+    Serial.println("Error settings up MDNS responder");
+  } else {
+    Serial.print("Listening on ");
+    Serial.print(MDNS_NAME);
+    Serial.println(".local");
+  }
+  lastReport = millis();
+}
+
+// Prints "<label><count>/s avg/max <avg>/<max> us"
+static void printTiming(const char* label, const Timing& t, uint32_t elapsed) {
+  Serial.print(label);
+  Serial.print(t.count * 1000UL / elapsed);
+  Serial.print("/s avg/max ");
+  Serial.print(t.count ? t.total / t.count : 0);
+  Serial.print("/");
+  Serial.print(t.max);
+  Serial.print(" us");
+}
+
+static void report() {
+  uint32_t elapsed = millis() - lastReport;
+  printTiming("http ", http, elapsed);
+  printTiming(" (work ", httpWork, elapsed);
+  printTiming(") mdns ", mdnsWork, elapsed);
+#if MDNS_ENABLE_STATS
+  uint32_t answers = mdns.getStats().answersSent;
+  Serial.print(" answers ");
+  Serial.print((answers - lastAnswers) * 1000UL / elapsed);
+  Serial.print("/s");
+  lastAnswers = answers;
+#endif
+  printTiming(" other ", otherWork, elapsed);
+  Serial.print(" poll ");
+  Serial.print(pollTotal / (elapsed / 1000));
+  Serial.println(" us/s");
+
+  memset(&http, 0, sizeof http);
+  memset(&httpWork, 0, sizeof httpWork);
+  memset(&mdnsWork, 0, sizeof mdnsWork);
+  memset(&otherWork, 0, sizeof otherWork);
+  pollTotal = 0;
+  lastReport = millis();
+}
+
+void loop(){
+  word len = ether.packetReceive();
+  if (len == 0) {
+    idleSince = micros();
+    ether.packetLoop(len);
+  } else {
+    bool query = isMdns();
+    uint32_t start = micros();
+    word pos = ether.packetLoop(len);
+    if (pos) {
+      memcpy_P(ether.tcpOffset(), page, sizeof page);
+      ether.httpServerReply(sizeof page - 1);
+      uint32_t end = micros();
+      add(httpWork, end - start);
+      add(http, end - idleSince);
+    } else {
+      add(query ? mdnsWork : otherWork, micros() - start);
+    }
+  }
+  // send MDNS answers that were held back
+  uint32_t start = micros();
+  mdns.poll();
+  pollTotal += micros() - start;
+
+  if (millis() - lastReport >= REPORT_INTERVAL) {
+    report();
+  }
+}
@@ -0,0 +1,70 @@
+// Host stand-in for the parts of the Arduino core that EC_MDNSResponder uses,
+// so the library can be built and driven on a PC by the tools in this
+// directory. Not for use on a board.
+
+#ifndef HostArduino_h
+#define HostArduino_h
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <avr/pgmspace.h>
+
+typedef uint8_t byte;
+typedef uint16_t word;
+
+#define DEC 10
+#define HEX 16
+
+// The clock is whatever the tool says it is: replay runs on capture time,
+// the load generator on the host's monotonic clock.
+extern uint64_t hostMicros;
+inline unsigned long millis() { return (unsigned long)(hostMicros / 1000); }
+inline unsigned long micros() { return (unsigned long)hostMicros; }
+
+inline long random(long howbig) { return howbig > 0 ? rand() % howbig : 0; }
+inline long random(long howsmall, long howbig) { return howsmall + random(howbig - howsmall); }
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(PSTR(s)))
+
+class Print {
+	public:
+		virtual ~Print() {}
+		virtual size_t write(uint8_t c) = 0;
+		size_t print(const char* s) { size_t n = 0; while (*s) n += write(*s++); return n; }
+		size_t print(const __FlashStringHelper* s) { return print((const char*)s); }
+		size_t print(char c) { return write(c); }
+		size_t print(unsigned long v, int base = DEC) { return printNumber(base == HEX ? "%lX" : "%lu", v); }
+		size_t print(long v, int base = DEC) { return base == DEC ? printNumber("%ld", v) : print((unsigned long)v, base); }
+		size_t print(unsigned int v, int base = DEC) { return print((unsigned long)v, base); }
+		size_t print(int v, int base = DEC) { return print((long)v, base); }
+		size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+		size_t println() { return write('\n'); }
+		template <class T> size_t println(T v) { return print(v) + println(); }
+		template <class T> size_t println(T v, int base) { return print(v, base) + println(); }
+
+	private:
+		size_t printNumber(const char* format, ...) {
+			char text[24];
+			va_list args;
+			va_start(args, format);
+			vsnprintf(text, sizeof(text), format, args);
+			va_end(args);
+			return print(text);
+		}
+};
+
+// Writes to stderr, so that tools can keep stdout for their results.
+class HardwareSerial : public Print {
+	public:
+		void begin(unsigned long) {}
+		size_t write(uint8_t c) { return fputc(c, stderr) != EOF; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
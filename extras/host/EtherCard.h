@@ -0,0 +1,112 @@
+// Host stand-in for the EtherCard API used by EC_MDNSResponder and the
+// sketches in examples. Frames live in Ethernet::buffer with EtherCard's
+// layout, so the responder's offsets work unchanged. Tools hand received
+// datagrams in with hostReceive(), or whole frames to packetReceive() through
+// hostNextFrame, and see everything sent through hostSent.
+//
+// Tools get a buffer of HOST_BUFFER_SIZE bytes from host.cpp. A sketch
+// defines its own, as on a board, and is built with HOST_SKETCH defined.
+
+#ifndef EtherCard_h
+#define EtherCard_h
+
+#include <Arduino.h>
+
+#define ETH_DST_MAC 0
+#define ETH_SRC_MAC 6
+#define ETH_TYPE_H_P 12
+#define ETH_TYPE_L_P 13
+#define ETH_TYPE_IP_H_V 0x08
+#define ETH_TYPE_IP_L_V 0x00
+#define IP_P 14
+#define IP_TOTLEN_H_P 0x10
+#define IP_PROTO_P 0x17
+#define IP_PROTO_TCP_V 6
+#define IP_PROTO_UDP_V 17
+#define IP_SRC_P 0x1a
+#define IP_DST_P 0x1e
+#define UDP_SRC_PORT_H_P 0x22
+#define UDP_SRC_PORT_L_P 0x23
+#define UDP_DST_PORT_H_P 0x24
+#define UDP_DST_PORT_L_P 0x25
+#define UDP_LEN_H_P 0x26
+#define UDP_DATA_P 0x2a
+#define TCP_SRC_PORT_H_P 0x22
+#define TCP_DST_PORT_H_P 0x24
+#define TCP_HEADER_LEN_P 0x2e
+#define TCP_DATA_P 0x36
+
+#define HOST_BUFFER_SIZE 1500
+
+typedef void (*UdpServerCallback)(uint8_t dest_ip[4], uint16_t dest_port, uint8_t src_ip[4], const char *data, uint16_t len);
+
+// A datagram sent, as it lies in Ethernet::buffer. For the TCP replies of
+// httpServerReply() the ports are the TCP ports and data the payload.
+struct HostPacket {
+	const uint8_t* dstMac;
+	const uint8_t* dstIp;
+	uint16_t srcPort;
+	uint16_t dstPort;
+	const uint8_t* data;
+	uint16_t len;
+};
+
+typedef void (*HostSendHook)(const HostPacket& packet);
+
+// Copies the next frame the controller has received into buffer, at most
+// size bytes, and returns its length, or 0 if there is none.
+typedef uint16_t (*HostFrameHook)(uint8_t* buffer, uint16_t size);
+
+class Ethernet {
+	public:
+		static uint8_t buffer[];
+		static uint16_t bufferSize;
+};
+
+class EtherCard : public Ethernet {
+	public:
+		static uint8_t mymac[6];
+		static uint8_t myip[4];
+		static uint8_t gwip[4];
+		static uint8_t dnsip[4];
+		static uint8_t broadcastip[4];
+		static uint8_t netmask[4];
+
+		static uint8_t begin(uint16_t size, const uint8_t* macaddr, uint8_t csPin = 8);
+		static bool dhcpSetup() { return true; }
+		static bool staticSetup(const uint8_t* ip, const uint8_t* gw = 0, const uint8_t* dns = 0, const uint8_t* mask = 0);
+		static void printIp(const char* msg, const uint8_t* buf);
+		static uint16_t packetReceive();
+		// Hands UDP datagrams to their listener and returns 0, or for a TCP
+		// segment to port 80 with data the offset of that data.
+		static uint16_t packetLoop(uint16_t plen);
+		static uint8_t* tcpOffset() { return buffer + TCP_DATA_P; }
+		static void httpServerReply(uint16_t dlen);
+		static void disableMulticast() {}
+		static void enableBroadcast(bool temporary = false) { (void) temporary; }
+		static void udpServerListen(UdpServerCallback callback, uint8_t ip[4], uint16_t port, bool bigEndian);
+		static void makeUdpReply(const char* data, uint8_t len, uint16_t port);
+		static void udpPrepare(uint16_t sport, const uint8_t* dip, uint16_t dport);
+		static void udpTransmit(uint16_t len);
+};
+
+extern EtherCard ether;
+
+// Called for every datagram the responder transmits; may be NULL.
+extern HostSendHook hostSent;
+
+// Where packetReceive() takes frames from; may be NULL for none.
+extern HostFrameHook hostNextFrame;
+
+// Builds the frame of a datagram from srcMac/srcIp:srcPort to dstIp:dstPort
+// in frame, which must hold UDP_DATA_P + len bytes, and returns its length.
+uint16_t hostUdpFrame(uint8_t* frame, const uint8_t srcMac[6], const uint8_t srcIp[4], uint16_t srcPort,
+		const uint8_t dstIp[4], uint16_t dstPort, const uint8_t* data, uint16_t len);
+
+// Delivers a UDP payload from srcMac/srcIp:srcPort to dstIp:dstPort to the
+// listener on dstPort. Returns false if nothing listens there or the payload
+// does not fit in the buffer.
+bool hostReceive(const uint8_t srcMac[6], const uint8_t srcIp[4], uint16_t srcPort,
+		const uint8_t dstIp[4], uint16_t dstPort, const uint8_t* data, uint16_t len);
+
+#endif
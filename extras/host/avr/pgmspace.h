@@ -0,0 +1,31 @@
+// Host stand-in for avr-libc's program memory helpers: flash is ordinary
+// memory on a PC, so they map onto the plain C library.
+
+#ifndef HostPgmspace_h
+#define HostPgmspace_h
+
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#define pgm_read_ptr(p) (*(void* const*)(p))
+
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcasecmp_P strcasecmp
+#define strncasecmp_P strncasecmp
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+
+#endif
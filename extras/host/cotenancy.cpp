@@ -0,0 +1,353 @@
+// Runs the backSoonMDNSLoad sketch on the host stub, with HTTP requests mixed
+// into a storm of mDNS queries, and reports what the storm does to the HTTP
+// replies.
+//
+//   cotenancy [-r rate,...] [-H rate] [-d seconds] [-f bytes] [-x scale]
+//             [-S ns] [-n name] [-s type.proto] [-q questions] [-u share]
+//             [-l share] [-k answers] [-m share] [-N names]
+//
+// For each mDNS query rate of -r the sketch runs -d seconds of simulated time
+// while HTTP requests come in at -H per second, both as Poisson arrivals over
+// a 10 Mbit/s link. The queries are those of loadgen, with the same options.
+// Frames wait in the controller's receive buffer, -f bytes as EtherCard sets
+// it up, until the sketch's packetReceive() takes them. A frame that does not
+// fit is dropped, as the controller does when the sketch falls behind.
+//
+// The clock only moves for work: reading a frame from the controller or
+// writing one to it takes -S ns per byte (1000, SPI at 8 MHz), a frame can
+// only be written once the one before has left, and whatever the sketch and
+// the responder do in between is charged as the host time it took times -x.
+// The host is much faster than an AVR, so raise -x to see the CPU's share.
+// Only the request segment of an HTTP exchange is simulated, not the
+// handshake around it.
+//
+// HTTP latency is counted from the request being in the controller to the
+// reply being written to it. A dropped request would cost its client a TCP
+// retransmission timeout, which is not simulated: drops are counted instead.
+// The sketch prints its own reports to stderr.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "EC_MDNSResponder.h"
+#include "query.h"
+
+#define MDNS_PORT 5353
+#define HTTP_PORT 80
+#define MAX_RATES 16
+#define MAX_FRAME 1514
+#define FIFO_SLOTS 128        // Enough for 8 KB, all of the controller's RAM, of the smallest frames
+#define WIRE_NS_PER_BYTE 800  // 10 Mbit/s
+#define WIRE_OVERHEAD 24      // Preamble, CRC and inter-frame gap
+#define FIFO_OVERHEAD 10      // Receive status vector and CRC
+
+// The sketch
+void setup();
+void loop();
+
+static const char request[] =
+    "GET / HTTP/1.0\r\nHost: 192.168.1.200\r\nUser-Agent: ApacheBench/2.3\r\nAccept: */*\r\n\r\n";
+
+struct Frame {
+  uint8_t data[MAX_FRAME];
+  uint16_t len;
+  bool http;
+  uint64_t arrived;           // ns
+};
+
+// The controller's receive buffer
+static Frame fifo[FIFO_SLOTS];
+static uint8_t fifoHead;
+static uint8_t fifoCount;
+static uint32_t fifoBytes;
+static uint32_t fifoSize = 3072;
+
+static uint64_t now;          // Simulated ns
+static uint64_t end;
+static uint64_t hostThen;     // Host ns of the last charge()
+static double workScale = 1;
+static uint32_t spiNs = 1000;
+static uint64_t wireFree;     // When the link is free for the next frame
+static uint64_t txFree;       // When the controller is done sending
+
+static double mdnsRate;
+static double httpRate;
+static uint64_t nextMdns;
+static uint64_t nextHttp;
+static Frame pending;         // The next frame on the link
+static bool pendingValid;
+static Mix mix = { "arduino", NULL, 1, 0, 0, 0, 0, 1000 };
+static uint16_t queryId;
+
+static unsigned long mdnsOffered;
+static unsigned long mdnsDropped;
+static unsigned long httpOffered;
+static unsigned long httpDropped;
+static unsigned long answers;
+static uint64_t requestArrived;  // Of the HTTP request being handled
+static uint64_t* latencies;
+static unsigned long replies;
+static unsigned long maxReplies;
+
+static void fail(const char* message, const char* detail) {
+  fprintf(stderr, "cotenancy: %s%s%s\n", message, detail ? ": " : "", detail ? detail : "");
+  exit(1);
+}
+
+static uint64_t hostNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void advance(uint64_t ns) {
+  now += ns;
+  hostMicros = now / 1000;
+}
+
+// Charges the host time since the last call as work.
+static void charge() {
+  uint64_t host = hostNs();
+  advance((uint64_t)((host - hostThen) * workScale));
+  hostThen = host;
+}
+
+static uint64_t interval(double rate) {
+  double u = (rand() + 1.0) / ((double) RAND_MAX + 2.0);
+  return (uint64_t)(-log(u) / rate * 1e9);
+}
+
+static uint16_t httpFrame(uint8_t* frame) {
+  static const uint8_t mac[6] = { 0x02, 0x00, 0xc0, 0xa8, 0x01, 0x0a };
+  static const uint8_t ip[4] = { 192, 168, 1, 10 };
+  uint16_t len = sizeof(request) - 1;
+  uint16_t port = 32768 + rand() % 28232;
+  memset(frame, 0, TCP_DATA_P);
+  memcpy(frame + ETH_DST_MAC, EtherCard::mymac, 6);
+  memcpy(frame + ETH_SRC_MAC, mac, 6);
+  frame[ETH_TYPE_H_P] = ETH_TYPE_IP_H_V;
+  frame[ETH_TYPE_L_P] = ETH_TYPE_IP_L_V;
+  frame[IP_P] = 0x45;
+  frame[IP_TOTLEN_H_P] = (40 + len) >> 8;
+  frame[IP_TOTLEN_H_P + 1] = 40 + len;
+  frame[IP_PROTO_P] = IP_PROTO_TCP_V;
+  memcpy(frame + IP_SRC_P, ip, 4);
+  memcpy(frame + IP_DST_P, EtherCard::myip, 4);
+  frame[TCP_SRC_PORT_H_P] = port >> 8;
+  frame[TCP_SRC_PORT_H_P + 1] = port;
+  frame[TCP_DST_PORT_H_P] = HTTP_PORT >> 8;
+  frame[TCP_DST_PORT_H_P + 1] = HTTP_PORT;
+  frame[TCP_HEADER_LEN_P] = 0x50;
+  memcpy(frame + TCP_DATA_P, request, len);
+  return TCP_DATA_P + len;
+}
+
+static uint16_t mdnsFrame(uint8_t* frame) {
+  static const uint8_t group[4] = { 224, 0, 0, 251 };
+  uint8_t ip[4] = { 192, 168, 1, (uint8_t)(20 + rand() % 200) };
+  uint8_t mac[6] = { 0x02, 0x00, ip[0], ip[1], ip[2], ip[3] };
+  uint8_t packet[MAX_FRAME - UDP_DATA_P];
+  size_t len;
+  bool legacy;
+  if (++queryId == 0) {
+    queryId = 1;
+  }
+  buildQuery(mix, queryId, packet, &len, &legacy);
+  return hostUdpFrame(frame, mac, ip, legacy ? 49152 + rand() % 16384 : MDNS_PORT, group, MDNS_PORT, packet, len);
+}
+
+// Makes the next frame to come over the link the pending one, unless it is
+// due at or after the end. The link carries one frame at a time, so a frame
+// is complete once it and those before it have come over.
+static bool nextFrame() {
+  if (pendingValid) {
+    return true;
+  }
+  bool http = nextHttp < nextMdns;
+  uint64_t due = http ? nextHttp : nextMdns;
+  if (due >= end) {
+    return false;
+  }
+  if (http) {
+    nextHttp += interval(httpRate);
+    httpOffered++;
+  }
+  else {
+    nextMdns += interval(mdnsRate);
+    mdnsOffered++;
+  }
+  pending.len = http ? httpFrame(pending.data) : mdnsFrame(pending.data);
+  pending.http = http;
+  uint16_t wire = (pending.len < 60 ? 60 : pending.len) + WIRE_OVERHEAD;
+  pending.arrived = (due > wireFree ? due : wireFree) + (uint64_t) wire * WIRE_NS_PER_BYTE;
+  wireFree = pending.arrived;
+  pendingValid = true;
+  return true;
+}
+
+// Puts the frames that have come in by now into the receive buffer, or
+// drops them if it is full.
+static void deliver() {
+  while (nextFrame() && pending.arrived <= now) {
+    pendingValid = false;
+    uint32_t bytes = (pending.len + FIFO_OVERHEAD + 1) & ~1;
+    if (fifoBytes + bytes > fifoSize || fifoCount == FIFO_SLOTS) {
+      (pending.http ? httpDropped : mdnsDropped)++;
+      continue;
+    }
+    Frame& slot = fifo[(fifoHead + fifoCount) % FIFO_SLOTS];
+    memcpy(slot.data, pending.data, pending.len);
+    slot.len = pending.len;
+    slot.http = pending.http;
+    slot.arrived = pending.arrived;
+    fifoCount++;
+    fifoBytes += bytes;
+  }
+}
+
+static uint16_t onNextFrame(uint8_t* buffer, uint16_t size) {
+  charge();
+  deliver();
+  if (fifoCount == 0) {
+    // Nothing to do until the next frame is in, so skip ahead to it, or to
+    // the end if none is coming.
+    uint64_t due = nextFrame() ? pending.arrived : end;
+    if (due > now) {
+      advance(due - now);
+    }
+    deliver();
+    hostThen = hostNs();
+    return 0;
+  }
+  Frame& frame = fifo[fifoHead];
+  fifoHead = (fifoHead + 1) % FIFO_SLOTS;
+  fifoCount--;
+  fifoBytes -= (frame.len + FIFO_OVERHEAD + 1) & ~1;
+  uint16_t len = frame.len < size ? frame.len : size;
+  memcpy(buffer, frame.data, len);
+  advance((uint64_t) len * spiNs);
+  if (frame.http) {
+    requestArrived = frame.arrived;
+  }
+  hostThen = hostNs();
+  return len;
+}
+
+static void onSent(const HostPacket& packet) {
+  charge();
+  uint16_t len = (packet.srcPort == HTTP_PORT ? TCP_DATA_P : UDP_DATA_P) + packet.len;
+  if (txFree > now) {
+    advance(txFree - now);
+  }
+  advance((uint64_t) len * spiNs);
+  txFree = now + (uint64_t)((len < 60 ? 60 : len) + WIRE_OVERHEAD) * WIRE_NS_PER_BYTE;
+  if (packet.srcPort == HTTP_PORT) {
+    if (replies < maxReplies) {
+      latencies[replies++] = now - requestArrived;
+    }
+  }
+  else {
+    answers++;
+  }
+  hostThen = hostNs();
+}
+
+static int compareLatencies(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a;
+  uint64_t y = *(const uint64_t*) b;
+  return x < y ? -1 : x > y;
+}
+
+static void run(double rate, double seconds) {
+  srand(1);
+  mdnsRate = rate;
+  fifoHead = fifoCount = 0;
+  fifoBytes = 0;
+  mdnsOffered = mdnsDropped = httpOffered = httpDropped = answers = replies = 0;
+  wireFree = txFree = now;
+  pendingValid = false;
+  end = now + (uint64_t)(seconds * 1e9);
+  nextMdns = rate > 0 ? now + interval(rate) : UINT64_MAX;
+  nextHttp = now + interval(httpRate);
+
+  setup();
+  hostThen = hostNs();
+  while (now < end || fifoCount > 0) {
+    loop();
+  }
+
+  printf("%8.0f %8.1f %7.2f%% %9.1f %8.1f %7.2f%%", rate, mdnsOffered / seconds,
+      mdnsOffered ? 100.0 * mdnsDropped / mdnsOffered : 0.0, answers / seconds, httpOffered / seconds,
+      httpOffered ? 100.0 * httpDropped / httpOffered : 0.0);
+  if (replies) {
+    qsort(latencies, replies, sizeof(uint64_t), compareLatencies);
+    printf(" %9.1f %9.1f %9.1f", latencies[replies / 2] / 1e3, latencies[replies * 99 / 100] / 1e3,
+        latencies[replies - 1] / 1e3);
+  }
+  printf("\n");
+}
+
+static void usage() {
+  fprintf(stderr, "usage: cotenancy [-r rate,...] [-H rate] [-d seconds] [-f bytes] [-x scale] [-S ns] [-n name]\n"
+      "                 [-s type.proto] [-q questions] [-u share] [-l share] [-k answers] [-m share] [-N names]\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  double rates[MAX_RATES] = { 0, 500, 1000, 2000, 5000 };
+  unsigned rateCount = 5;
+  double seconds = 10;
+  httpRate = 50;
+  char service[64] = "";
+  int opt;
+  while ((opt = getopt(argc, argv, "r:H:d:f:x:S:n:s:q:u:l:k:m:N:")) != -1) {
+    switch (opt) {
+      case 'r':
+        rateCount = 0;
+        for (char* p = optarg; *p && rateCount < MAX_RATES; p += *p == ',') {
+          char* next;
+          rates[rateCount++] = strtod(p, &next);
+          if (next == p || rates[rateCount - 1] < 0) {
+            usage();
+          }
+          p = next;
+        }
+        break;
+      case 'H': httpRate = atof(optarg); break;
+      case 'd': seconds = atof(optarg); break;
+      case 'f': fifoSize = atoi(optarg); break;
+      case 'x': workScale = atof(optarg); break;
+      case 'S': spiNs = atoi(optarg); break;
+      case 'n': mix.name = optarg; break;
+      case 's': snprintf(service, sizeof(service), "%s", optarg); mix.service = service; break;
+      case 'q': mix.questions = atoi(optarg); break;
+      case 'u': mix.unicast = share(optarg); break;
+      case 'l': mix.legacy = share(optarg); break;
+      case 'k': mix.knownAnswers = atoi(optarg); break;
+      case 'm': mix.misses = share(optarg); break;
+      case 'N': mix.names = atoi(optarg); break;
+      default: usage();
+    }
+  }
+  if (optind != argc || rateCount == 0 || httpRate <= 0 || seconds <= 0 || fifoSize < 64 || fifoSize > 8192 || workScale < 0
+      || mix.questions < 1 || mix.questions > 32 || mix.knownAnswers > 16 || mix.names < 1) {
+    usage();
+  }
+  // Far more requests than the rate gives on average
+  maxReplies = (unsigned long)(httpRate * seconds * 2 + 100);
+  latencies = (uint64_t*) malloc(maxReplies * sizeof(uint64_t));
+  if (!latencies) {
+    fail("out of memory", NULL);
+  }
+  hostSent = onSent;
+  hostNextFrame = onNextFrame;
+
+  printf("  mdns/s  offered  dropped answers/s   http/s  dropped   p50 us    p99 us    max us\n");
+  for (unsigned i = 0; i < rateCount; i++) {
+    run(rates[i], seconds);
+  }
+  free(latencies);
+  return 0;
+}
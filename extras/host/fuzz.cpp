@@ -0,0 +1,517 @@
+// Searches for the packets that cost onUdpReceive() the most, and checks a
+// corpus of them against a bound.
+//
+// Cost is the number of basic blocks the library executes while it handles
+// a packet: EC_MDNSResponder.cpp is compiled with
+// -fsanitize-coverage=trace-pc and __sanitizer_cov_trace_pc() below counts
+// them. It stands in for an instruction count, but unlike one it is the same
+// on every run and every machine with the same compiler, so a bound on it can
+// be checked in a test. The responder is set up afresh for every packet, so
+// a packet always costs the same.
+//
+// Built with libFuzzer (make fuzz-libfuzzer, needs clang), cost per byte,
+// cost per packet and compression pointer hops are fed back as extra
+// counters, so inputs that raise any of them are kept like new coverage.
+// FUZZ_WORST=dir saves every input that sets a new record there, and
+// FUZZ_BOUND=n aborts on a packet that costs more than n blocks.
+//
+// Built on its own (make fuzz, any compiler):
+//
+//   fuzz [-b bound] [-o dir] [-t seconds] [-m maxlen] file|dir...
+//
+// lists the cost of each input, and with -b fails if one is over the bound.
+// With -t it also runs a coverage- and cost-guided search of its own from
+// those inputs for that long, and writes the costliest packet and the one
+// costliest per byte it found to -o.
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "EC_MDNSResponder.h"
+
+#define MDNS_PORT 5353
+#define MAX_PAYLOAD (HOST_BUFFER_SIZE - UDP_DATA_P)
+#define MAX_HOPS 255          // Pointer hops followed per name when counting
+#define COVERAGE_SIZE 16384   // Slots for the blocks seen, hashed by address
+
+static bool counting;
+static unsigned long blocks;
+static uint8_t coverage[COVERAGE_SIZE];
+
+extern "C" void __sanitizer_cov_trace_pc() {
+  if (counting) {
+    uintptr_t pc = (uintptr_t) __builtin_return_address(0);
+    blocks++;
+    coverage[(pc ^ pc >> 14) % COVERAGE_SIZE] = 1;
+  }
+}
+
+static const uint8_t source[4] = { 192, 168, 1, 50 };
+static const uint8_t sourceMac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x32 };
+static const uint8_t multicast[4] = { 224, 0, 0, 251 };
+
+static void setup() {
+  hostMicros = 1000000;
+  EC_MDNSResponder::begin("arduino", ether);
+#if MDNS_ENABLE_SERVICES
+  uint8_t http = EC_MDNSResponder::addService("_http", "_tcp", 80);
+  EC_MDNSResponder::addSubtype(http, "_printer");
+  EC_MDNSResponder::setTxt(http, PSTR("path"), "/");
+  EC_MDNSResponder::addService("_ipp", "_tcp", 631);
+#endif
+}
+
+// Blocks executed handling data as a query from source:5353.
+static unsigned long cost(const uint8_t* data, size_t len) {
+  setup();
+  memset(coverage, 0, sizeof(coverage));
+  blocks = 0;
+  counting = true;
+  hostReceive(sourceMac, source, MDNS_PORT, multicast, MDNS_PORT, data, len);
+  counting = false;
+  return blocks;
+}
+
+// Most compression pointers followed by one question name, following them in
+// any direction. The responder follows at most MAX_POINTERS.
+static unsigned hops(const uint8_t* data, size_t len) {
+  if (len < 12) {
+    return 0;
+  }
+  unsigned most = 0;
+  size_t pos = 12;
+  for (unsigned q = data[4] << 8 | data[5]; q > 0 && pos < len; q--) {
+    unsigned h = 0;
+    size_t end = 0;
+    size_t p = pos;
+    while (p < len && data[p] != 0) {
+      if ((data[p] & 0xC0) == 0xC0) {
+        if (p + 1 >= len || h == MAX_HOPS) {
+          break;
+        }
+        if (end == 0) {
+          end = p + 2;
+        }
+        h++;
+        p = (data[p] & 0x3F) << 8 | data[p + 1];
+      }
+      else {
+        p += 1 + data[p];
+      }
+    }
+    if (h > most) {
+      most = h;
+    }
+    pos = (end != 0 ? end : p + 1) + 4;
+  }
+  return most;
+}
+
+#ifdef FUZZ_LIBFUZZER
+
+static unsigned bucket(unsigned long v) {
+  unsigned n = 0;
+  while (v >>= 1) {
+    n++;
+  }
+  return n;
+}
+
+// Buckets: 16 for log2 of cost per byte in 1/16 blocks, 24 for log2 of cost
+// per packet, 64 for pointer hops.
+__attribute__((section("__libfuzzer_extra_counters"))) static uint8_t extraCounters[16 + 24 + 64];
+
+static unsigned long bound;
+static const char* worstDir;
+static unsigned long worstCost;
+static unsigned long worstPerByte;
+
+static void save(const char* kind, unsigned long value, const uint8_t* data, size_t len) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s-%lu", worstDir, kind, value);
+  FILE* f = fopen(path, "wb");
+  if (f) {
+    fwrite(data, 1, len, f);
+    fclose(f);
+  }
+}
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv) {
+  const char* b = getenv("FUZZ_BOUND");
+  bound = b ? strtoul(b, NULL, 10) : 0;
+  worstDir = getenv("FUZZ_WORST");
+  return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t len) {
+  if (len == 0 || len > MAX_PAYLOAD) {
+    return 0;
+  }
+  unsigned long c = cost(data, len);
+  unsigned long perByte = c * 16 / len;
+  unsigned h = hops(data, len);
+  extraCounters[bucket(perByte) < 15 ? bucket(perByte) : 15]++;
+  extraCounters[16 + (bucket(c) < 23 ? bucket(c) : 23)]++;
+  extraCounters[40 + (h < 63 ? h : 63)]++;
+  if (worstDir && c > worstCost) {
+    worstCost = c;
+    save("packet", c, data, len);
+  }
+  if (worstDir && perByte > worstPerByte && len >= 12) {
+    worstPerByte = perByte;
+    save("byte", perByte, data, len);
+  }
+  if (bound && c > bound) {
+    fprintf(stderr, "fuzz: %lu blocks for %zu bytes, over the bound of %lu\n", c, len, bound);
+    abort();
+  }
+  return 0;
+}
+
+#else
+
+#define POOL_SIZE 4096
+
+struct Input {
+  uint8_t data[MAX_PAYLOAD];
+  uint16_t len;
+  unsigned long cost;
+  unsigned hops;
+  char* name;
+};
+
+static Input* pool;
+static size_t poolCount;
+static uint8_t seen[COVERAGE_SIZE];
+static size_t seenCount;
+static size_t maxLen = MAX_PAYLOAD;
+
+static void fail(const char* message, const char* detail) {
+  fprintf(stderr, "fuzz: %s%s%s\n", message, detail ? ": " : "", detail ? detail : "");
+  exit(2);
+}
+
+static uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Fastest of a number of runs, for a feel of what the blocks cost in time
+static uint64_t timeNs(const uint8_t* data, size_t len) {
+  uint64_t best = UINT64_MAX;
+  for (uint8_t i = 0; i < 20; i++) {
+    setup();
+    uint64_t t = nowNs();
+    hostReceive(sourceMac, source, MDNS_PORT, multicast, MDNS_PORT, data, len);
+    t = nowNs() - t;
+    if (t < best) {
+      best = t;
+    }
+  }
+  return best;
+}
+
+// Merges the blocks of the last run into those seen so far. Returns the
+// number that are new.
+static size_t mergeCoverage() {
+  size_t fresh = 0;
+  for (size_t i = 0; i < COVERAGE_SIZE; i++) {
+    if (coverage[i] && !seen[i]) {
+      seen[i] = 1;
+      fresh++;
+    }
+  }
+  seenCount += fresh;
+  return fresh;
+}
+
+static Input* add(const uint8_t* data, size_t len, unsigned long c, const char* name) {
+  if (poolCount == POOL_SIZE) {
+    // Make room by dropping an input at random. The costliest ones are kept
+    // apart by search().
+    size_t i = rand() % poolCount;
+    free(pool[i].name);
+    pool[i] = pool[--poolCount];
+  }
+  Input& in = pool[poolCount++];
+  memcpy(in.data, data, len);
+  in.len = len;
+  in.cost = c;
+  in.hops = hops(data, len);
+  in.name = name ? strdup(name) : NULL;
+  return &in;
+}
+
+static void load(const char* path) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    fail(path, strerror(errno));
+  }
+  if (S_ISDIR(st.st_mode)) {
+    struct dirent** entries;
+    int n = scandir(path, &entries, NULL, alphasort);
+    if (n < 0) {
+      fail(path, strerror(errno));
+    }
+    for (int i = 0; i < n; i++) {
+      if (entries[i]->d_name[0] != '.') {
+        char child[1024];
+        snprintf(child, sizeof(child), "%s/%s", path, entries[i]->d_name);
+        load(child);
+      }
+      free(entries[i]);
+    }
+    free(entries);
+    return;
+  }
+  uint8_t data[MAX_PAYLOAD];
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    fail(path, strerror(errno));
+  }
+  size_t len = fread(data, 1, sizeof(data), f);
+  if (fgetc(f) != EOF) {
+    fclose(f);
+    fail("longer than a packet", path);
+  }
+  fclose(f);
+  unsigned long c = cost(data, len);
+  mergeCoverage();
+  add(data, len, c, path);
+}
+
+// Offsets of the question names in data, up to max of them
+static size_t questionNames(const uint8_t* data, size_t len, uint16_t* names, size_t max) {
+  size_t n = 0;
+  size_t pos = 12;
+  for (unsigned q = len >= 12 ? (data[4] << 8 | data[5]) : 0; q > 0 && pos < len && n < max; q--) {
+    names[n++] = pos;
+    while (pos < len && data[pos] != 0 && (data[pos] & 0xC0) != 0xC0) {
+      pos += 1 + data[pos];
+    }
+    pos += (pos < len && data[pos] != 0) ? 2 : 1;
+    pos += 4;
+  }
+  return n;
+}
+
+static void insert(uint8_t* data, size_t* len, size_t at, const uint8_t* bytes, size_t n) {
+  if (*len + n > maxLen) {
+    n = maxLen - *len;
+  }
+  memmove(data + at + n, data + at, *len - at);
+  memcpy(data + at, bytes, n);
+  *len += n;
+}
+
+static void setCount(uint8_t* data, size_t len, uint8_t field, unsigned count) {
+  if (len >= 12) {
+    data[4 + field * 2] = count >> 8;
+    data[5 + field * 2] = count;
+  }
+}
+
+// One random change, mostly at the level of DNS messages
+static void mutate(uint8_t* data, size_t* len) {
+  static const uint8_t interesting[] = { 0x00, 0x01, 0x3F, 0x40, 0x7F, 0x80, 0xC0, 0xFF };
+  uint8_t bytes[64];
+  size_t pos = *len ? rand() % *len : 0;
+  switch (rand() % 9) {
+    case 0:
+      if (*len) {
+        data[pos] ^= 1 << (rand() % 8);
+      }
+      break;
+    case 1:
+      if (*len) {
+        data[pos] = rand() % 2 ? interesting[rand() % sizeof(interesting)] : rand();
+      }
+      break;
+    case 2: {
+      // Random bytes
+      size_t n = 1 + rand() % 8;
+      for (size_t i = 0; i < n; i++) {
+        bytes[i] = rand();
+      }
+      insert(data, len, pos, bytes, n);
+      break;
+    }
+    case 3:
+      if (*len > 12) {
+        size_t n = 1 + rand() % (*len - pos < 16 ? *len - pos : 16);
+        memmove(data + pos, data + pos + n, *len - pos - n);
+        *len -= n;
+      }
+      break;
+    case 4:
+      // A compression pointer to anywhere before it
+      if (pos > 0) {
+        uint16_t target = rand() % pos;
+        bytes[0] = 0xC0 | target >> 8;
+        bytes[1] = target;
+        insert(data, len, pos, bytes, 2);
+      }
+      break;
+    case 5:
+      // A copy of part of the packet
+      if (*len) {
+        size_t from = rand() % *len;
+        size_t n = 1 + rand() % (*len - from < 64 ? *len - from : 64);
+        memcpy(bytes, data + from, n);
+        insert(data, len, pos, bytes, n);
+      }
+      break;
+    case 6:
+      setCount(data, *len, rand() % 4, rand() % 4 ? rand() % 64 : rand() % 65536);
+      break;
+    case 7: {
+      // A question whose name points at an earlier one, mostly the last
+      uint16_t names[128];
+      size_t n = questionNames(data, *len, names, 128);
+      if (*len < 12 || n == 0 || *len + 6 > maxLen) {
+        break;
+      }
+      uint16_t target = names[rand() % 2 ? n - 1 : rand() % n];
+      uint8_t question[6] = { (uint8_t)(0xC0 | target >> 8), (uint8_t) target, 0, (uint8_t)(rand() % 2 ? 1 : 255), 0, 1 };
+      insert(data, len, *len, question, 6);
+      setCount(data, *len, 0, (data[4] << 8 | data[5]) + 1);
+      break;
+    }
+    case 8: {
+      // Part of another input from the pool
+      const Input& other = pool[rand() % poolCount];
+      if (other.len) {
+        size_t from = rand() % other.len;
+        size_t n = 1 + rand() % (other.len - from < 64 ? other.len - from : 64);
+        insert(data, len, pos, other.data + from, n);
+      }
+      break;
+    }
+  }
+}
+
+static void save(const char* dir, const char* kind, const Input& in) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s-%lu", dir, kind, in.cost);
+  FILE* f = fopen(path, "wb");
+  if (!f || fwrite(in.data, 1, in.len, f) != in.len) {
+    fail(path, strerror(errno));
+  }
+  fclose(f);
+  printf("wrote %s: %lu blocks, %u bytes\n", path, in.cost, in.len);
+}
+
+static void search(unsigned seconds, const char* dir) {
+  uint8_t data[MAX_PAYLOAD];
+  if (poolCount == 0) {
+    // An empty query to start from
+    uint8_t empty[12] = { 0 };
+    add(empty, sizeof(empty), cost(empty, sizeof(empty)), NULL);
+    mergeCoverage();
+  }
+  static Input worst;
+  static Input worstByte;
+  worst = worstByte = pool[0];
+  for (size_t i = 1; i < poolCount; i++) {
+    if (pool[i].cost > worst.cost) {
+      worst = pool[i];
+    }
+    if (pool[i].len >= 12 && pool[i].cost * worstByte.len > worstByte.cost * pool[i].len) {
+      worstByte = pool[i];
+    }
+  }
+  uint64_t end = nowNs() + (uint64_t) seconds * 1000000000;
+  uint64_t report = nowNs() + 1000000000ull * 5;
+  unsigned long runs = 0;
+  while (nowNs() < end) {
+    // Climb from the costliest input half the time
+    const Input& parent = rand() % 2 ? worst : pool[rand() % poolCount];
+    size_t len = parent.len;
+    memcpy(data, parent.data, len);
+    for (int n = 1 + rand() % 4; n > 0; n--) {
+      mutate(data, &len);
+    }
+    if (len == 0) {
+      continue;
+    }
+    unsigned long c = cost(data, len);
+    runs++;
+    size_t fresh = mergeCoverage();
+    bool costlier = c > worst.cost;
+    bool costlierByte = len >= 12 && c * worstByte.len > worstByte.cost * len;
+    if (fresh || costlier || costlierByte) {
+      Input* in = add(data, len, c, NULL);
+      if (in && costlier) {
+        worst = *in;
+      }
+      if (in && costlierByte) {
+        worstByte = *in;
+      }
+    }
+    if (nowNs() >= report) {
+      printf("%lu runs, %zu inputs, %zu blocks seen, costliest %lu blocks (%u bytes, %u hops), %.2f blocks/byte\n",
+          runs, poolCount, seenCount, worst.cost, worst.len, worst.hops, (double) worstByte.cost / worstByte.len);
+      fflush(stdout);
+      report += 1000000000ull * 5;
+    }
+  }
+  printf("%lu runs, costliest %lu blocks (%u bytes, %u hops), %.2f blocks/byte\n",
+      runs, worst.cost, worst.len, worst.hops, (double) worstByte.cost / worstByte.len);
+  if (dir) {
+    save(dir, "packet", worst);
+    save(dir, "byte", worstByte);
+  }
+}
+
+static void usage() {
+  fprintf(stderr, "usage: fuzz [-b bound] [-o dir] [-t seconds] [-m maxlen] file|dir...\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  unsigned long bound = 0;
+  unsigned seconds = 0;
+  const char* dir = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:o:t:m:")) != -1) {
+    switch (opt) {
+      case 'b': bound = strtoul(optarg, NULL, 10); break;
+      case 'o': dir = optarg; break;
+      case 't': seconds = atoi(optarg); break;
+      case 'm': maxLen = atoi(optarg); break;
+      default: usage();
+    }
+  }
+  if (maxLen < 12 || maxLen > MAX_PAYLOAD || (optind == argc && seconds == 0)) {
+    usage();
+  }
+  pool = (Input*) malloc(POOL_SIZE * sizeof(Input));
+  if (!pool) {
+    fail("out of memory", NULL);
+  }
+  srand(time(NULL));
+  for (int i = optind; i < argc; i++) {
+    load(argv[i]);
+  }
+
+  int status = 0;
+  for (size_t i = 0; i < poolCount; i++) {
+    const Input& in = pool[i];
+    bool over = bound && in.cost > bound;
+    printf("%-40s %5u bytes %6lu blocks %6.2f/byte %3u hops %7llu ns%s\n", in.name, in.len, in.cost,
+        in.len ? (double) in.cost / in.len : 0.0, in.hops, (unsigned long long) timeNs(in.data, in.len),
+        over ? "  over the bound" : "");
+    if (over) {
+      status = 1;
+    }
+  }
+  if (seconds) {
+    search(seconds, dir);
+  }
+  return status;
+}
+
+#endif
@@ -0,0 +1,221 @@
+// Definitions behind the host stand-ins in Arduino.h and EtherCard.h.
+
+#include "EtherCard.h"
+
+#define HOST_LISTENERS 8
+
+uint64_t hostMicros;
+HardwareSerial Serial;
+
+#ifndef HOST_SKETCH
+uint8_t Ethernet::buffer[HOST_BUFFER_SIZE];
+uint16_t Ethernet::bufferSize = HOST_BUFFER_SIZE;
+#else
+uint16_t Ethernet::bufferSize;  // Set by begin()
+#endif
+uint8_t EtherCard::mymac[6] = { 0x02, 0x45, 0x43, 0x4d, 0x44, 0x4e };
+uint8_t EtherCard::myip[4] = { 192, 168, 1, 200 };
+uint8_t EtherCard::gwip[4] = { 192, 168, 1, 1 };
+uint8_t EtherCard::dnsip[4] = { 192, 168, 1, 1 };
+uint8_t EtherCard::broadcastip[4] = { 192, 168, 1, 255 };
+uint8_t EtherCard::netmask[4] = { 255, 255, 255, 0 };
+EtherCard ether;
+
+HostSendHook hostSent;
+HostFrameHook hostNextFrame;
+
+static struct {
+  UdpServerCallback callback;
+  uint16_t port;
+} listeners[HOST_LISTENERS];
+static uint8_t listenerCount;
+
+static void setPorts(uint16_t sport, uint16_t dport) {
+  Ethernet::buffer[UDP_SRC_PORT_H_P] = sport >> 8;
+  Ethernet::buffer[UDP_SRC_PORT_L_P] = sport;
+  Ethernet::buffer[UDP_DST_PORT_H_P] = dport >> 8;
+  Ethernet::buffer[UDP_DST_PORT_L_P] = dport;
+}
+
+static void transmit(uint16_t len) {
+  if (!hostSent) {
+    return;
+  }
+  const uint8_t* buffer = Ethernet::buffer;
+  HostPacket packet;
+  packet.dstMac = buffer + ETH_DST_MAC;
+  packet.dstIp = buffer + IP_DST_P;
+  packet.srcPort = buffer[UDP_SRC_PORT_H_P] << 8 | buffer[UDP_SRC_PORT_L_P];
+  packet.dstPort = buffer[UDP_DST_PORT_H_P] << 8 | buffer[UDP_DST_PORT_L_P];
+  packet.data = buffer + UDP_DATA_P;
+  packet.len = len;
+  hostSent(packet);
+}
+
+// Hands the datagram in the buffer to the listener on its port, if any.
+static bool dispatch(uint16_t len) {
+  uint8_t* buffer = Ethernet::buffer;
+  uint16_t port = buffer[UDP_DST_PORT_H_P] << 8 | buffer[UDP_DST_PORT_L_P];
+  for (uint8_t i = 0; i < listenerCount; i++) {
+    if (listeners[i].port == port) {
+      listeners[i].callback(buffer + IP_DST_P, port, buffer + IP_SRC_P, (const char*) buffer + UDP_DATA_P, len);
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t EtherCard::begin(uint16_t size, const uint8_t* macaddr, uint8_t csPin) {
+  (void) csPin;
+  bufferSize = size;
+  memcpy(mymac, macaddr, 6);
+  return 6;  // The controller's revision, 0 if it does not answer
+}
+
+bool EtherCard::staticSetup(const uint8_t* ip, const uint8_t* gw, const uint8_t* dns, const uint8_t* mask) {
+  (void) dns;
+  memcpy(myip, ip, 4);
+  if (gw) {
+    memcpy(gwip, gw, 4);
+  }
+  if (mask) {
+    memcpy(netmask, mask, 4);
+  }
+  return true;
+}
+
+void EtherCard::printIp(const char* msg, const uint8_t* buf) {
+  Serial.print(msg);
+  for (uint8_t i = 0; i < 4; i++) {
+    Serial.print(buf[i]);
+    Serial.print(i < 3 ? '.' : '\n');
+  }
+}
+
+// Like EtherCard, keeps one byte of the buffer for a terminating 0.
+uint16_t EtherCard::packetReceive() {
+  if (!hostNextFrame) {
+    return 0;
+  }
+  uint16_t len = hostNextFrame(buffer, bufferSize - 1);
+  buffer[len] = 0;
+  return len;
+}
+
+uint16_t EtherCard::packetLoop(uint16_t plen) {
+  if (plen < UDP_DATA_P || buffer[ETH_TYPE_H_P] != ETH_TYPE_IP_H_V || buffer[ETH_TYPE_L_P] != ETH_TYPE_IP_L_V) {
+    return 0;
+  }
+  if (buffer[IP_PROTO_P] == IP_PROTO_UDP_V) {
+    uint16_t len = (buffer[UDP_LEN_H_P] << 8 | buffer[UDP_LEN_H_P + 1]) - 8;
+    if (UDP_DATA_P + len <= plen) {
+      dispatch(len);
+    }
+    return 0;
+  }
+  if (buffer[IP_PROTO_P] == IP_PROTO_TCP_V && plen > TCP_DATA_P
+      && (buffer[TCP_DST_PORT_H_P] << 8 | buffer[TCP_DST_PORT_H_P + 1]) == 80) {
+    return TCP_DATA_P;
+  }
+  return 0;
+}
+
+// Sends dlen bytes from tcpOffset() back to where the request came from.
+void EtherCard::httpServerReply(uint16_t dlen) {
+  memcpy(buffer + ETH_DST_MAC, buffer + ETH_SRC_MAC, 6);
+  memcpy(buffer + ETH_SRC_MAC, mymac, 6);
+  memcpy(buffer + IP_DST_P, buffer + IP_SRC_P, 4);
+  memcpy(buffer + IP_SRC_P, myip, 4);
+  if (!hostSent) {
+    return;
+  }
+  HostPacket packet;
+  packet.dstMac = buffer + ETH_DST_MAC;
+  packet.dstIp = buffer + IP_DST_P;
+  packet.srcPort = 80;
+  packet.dstPort = buffer[TCP_SRC_PORT_H_P] << 8 | buffer[TCP_SRC_PORT_H_P + 1];
+  packet.data = buffer + TCP_DATA_P;
+  packet.len = dlen;
+  hostSent(packet);
+}
+
+// A second call for a port replaces the listener, as a repeated begin()
+// makes it.
+void EtherCard::udpServerListen(UdpServerCallback callback, uint8_t ip[4], uint16_t port, bool bigEndian) {
+  (void) ip;
+  (void) bigEndian;
+  uint8_t i = 0;
+  while (i < listenerCount && listeners[i].port != port) {
+    i++;
+  }
+  if (i < HOST_LISTENERS) {
+    listeners[i].callback = callback;
+    listeners[i].port = port;
+    if (i == listenerCount) {
+      listenerCount++;
+    }
+  }
+}
+
+// Like EtherCard: turns the received frame around in place, payload capped
+// at 220 bytes.
+void EtherCard::makeUdpReply(const char* data, uint8_t len, uint16_t port) {
+  if (len > 220) {
+    len = 220;
+  }
+  memcpy(buffer + ETH_DST_MAC, buffer + ETH_SRC_MAC, 6);
+  memcpy(buffer + ETH_SRC_MAC, mymac, 6);
+  memcpy(buffer + IP_DST_P, buffer + IP_SRC_P, 4);
+  memcpy(buffer + IP_SRC_P, myip, 4);
+  setPorts(port, buffer[UDP_SRC_PORT_H_P] << 8 | buffer[UDP_SRC_PORT_L_P]);
+  memmove(buffer + UDP_DATA_P, data, len);
+  transmit(len);
+}
+
+// EtherCard addresses these to the gateway or the last host it resolved;
+// the responder overwrites the MAC where that matters.
+void EtherCard::udpPrepare(uint16_t sport, const uint8_t* dip, uint16_t dport) {
+  memcpy(buffer + ETH_DST_MAC, "\xff\xff\xff\xff\xff\xff", 6);
+  memcpy(buffer + ETH_SRC_MAC, mymac, 6);
+  memcpy(buffer + IP_DST_P, dip, 4);
+  memcpy(buffer + IP_SRC_P, myip, 4);
+  setPorts(sport, dport);
+}
+
+void EtherCard::udpTransmit(uint16_t len) {
+  transmit(len);
+}
+
+// Only what the responder and the sketches read is filled in: no
+// checksums, and a 20 byte IP header.
+uint16_t hostUdpFrame(uint8_t* frame, const uint8_t srcMac[6], const uint8_t srcIp[4], uint16_t srcPort,
+    const uint8_t dstIp[4], uint16_t dstPort, const uint8_t* data, uint16_t len) {
+  memset(frame, 0, UDP_DATA_P);
+  memcpy(frame + ETH_DST_MAC, EtherCard::mymac, 6);
+  memcpy(frame + ETH_SRC_MAC, srcMac, 6);
+  frame[ETH_TYPE_H_P] = ETH_TYPE_IP_H_V;
+  frame[ETH_TYPE_L_P] = ETH_TYPE_IP_L_V;
+  frame[IP_P] = 0x45;
+  frame[IP_TOTLEN_H_P] = (20 + 8 + len) >> 8;
+  frame[IP_TOTLEN_H_P + 1] = 20 + 8 + len;
+  frame[IP_PROTO_P] = IP_PROTO_UDP_V;
+  memcpy(frame + IP_SRC_P, srcIp, 4);
+  memcpy(frame + IP_DST_P, dstIp, 4);
+  frame[UDP_SRC_PORT_H_P] = srcPort >> 8;
+  frame[UDP_SRC_PORT_L_P] = srcPort;
+  frame[UDP_DST_PORT_H_P] = dstPort >> 8;
+  frame[UDP_DST_PORT_L_P] = dstPort;
+  frame[UDP_LEN_H_P] = (8 + len) >> 8;
+  frame[UDP_LEN_H_P + 1] = 8 + len;
+  memcpy(frame + UDP_DATA_P, data, len);
+  return UDP_DATA_P + len;
+}
+
+bool hostReceive(const uint8_t srcMac[6], const uint8_t srcIp[4], uint16_t srcPort,
+    const uint8_t dstIp[4], uint16_t dstPort, const uint8_t* data, uint16_t len) {
+  if (len > Ethernet::bufferSize - UDP_DATA_P) {
+    return false;
+  }
+  hostUdpFrame(Ethernet::buffer, srcMac, srcIp, srcPort, dstIp, dstPort, data, len);
+  return dispatch(len);
+}
@@ -0,0 +1,235 @@
+// Sends a mix of mDNS queries at a fixed rate to a responder and measures
+// how long answers take and how many never come.
+//
+//   loadgen [-t ip[:port]] [-b ip] [-r rate] [-d seconds] [-w ms] [-n name]
+//           [-s type.proto] [-q questions] [-u share] [-l share] [-k answers]
+//           [-m share] [-N names]
+//
+// The target is 127.0.0.1:5353 unless told otherwise, e.g. responder in this
+// directory. Queries come from port 5353 on the -b address (127.0.0.2) like
+// those of a full mDNS querier, or, for the -l share of them, from another
+// port like a legacy resolver. The -u share asks for unicast answers (QU).
+// Each query has 1 to -q questions. The -m share asks only for names that
+// are not the responder's, picked from -N distinct ones, and expects no
+// answer. The others ask for <name>.local, or half of them for the -s service
+// type, besides misses to fill up the questions. With -k every query lists
+// that many known answers for other instances, which the responder has to
+// read but which do not suppress anything.
+//
+// Answers are matched to queries by their ID, which responder copies into
+// the multicast answers a query causes. After -d seconds of sending it waits
+// -w ms for late answers and prints the latency percentiles of the first
+// answer to each query, the share of queries expecting an answer that got
+// none, and the number of answer packets.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "query.h"
+
+#define MDNS_PORT 5353
+#define MAX_PACKET 1458
+#define SLOTS 65536           // One per query ID
+
+static struct {
+  uint64_t sent;              // ns, 0 when the slot is free
+  bool expected;
+  bool answered;
+} slots[SLOTS];
+
+static int sockets[2];        // Querier, legacy
+static struct sockaddr_in target;
+
+static unsigned long queries;
+static unsigned long expected;
+static unsigned long answered;
+static unsigned long answerPackets;
+static unsigned long unexpected;  // Answers to queries that expected none
+static unsigned long unmatched;   // Answers with an unknown or stale ID
+static unsigned long sendErrors;
+static uint64_t* latencies;
+static uint64_t timeout;
+
+static void fail(const char* message, const char* detail) {
+  fprintf(stderr, "loadgen: %s%s%s\n", message, detail ? ": " : "", detail ? detail : "");
+  exit(1);
+}
+
+static uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool parseAddress(const char* text, struct sockaddr_in* address) {
+  char ip[32];
+  unsigned port = ntohs(address->sin_port);
+  const char* colon = strchr(text, ':');
+  size_t n = colon ? (size_t)(colon - text) : strlen(text);
+  if (n >= sizeof(ip) || (colon && (sscanf(colon + 1, "%u", &port) != 1 || port == 0 || port > 65535))) {
+    return false;
+  }
+  memcpy(ip, text, n);
+  ip[n] = 0;
+  address->sin_port = htons(port);
+  return inet_pton(AF_INET, ip, &address->sin_addr) == 1;
+}
+
+static void receive(int sock) {
+  uint8_t packet[MAX_PACKET];
+  ssize_t len;
+  while ((len = recv(sock, packet, sizeof(packet), MSG_DONTWAIT)) >= 0) {
+    uint64_t now = nowNs();
+    answerPackets++;
+    uint16_t id = len >= 2 ? packet[0] << 8 | packet[1] : 0;
+    if (id == 0 || slots[id].sent == 0 || now - slots[id].sent > timeout) {
+      unmatched++;
+    }
+    else if (!slots[id].expected) {
+      unexpected++;
+    }
+    else if (!slots[id].answered) {
+      slots[id].answered = true;
+      latencies[answered++] = now - slots[id].sent;
+    }
+  }
+}
+
+static int compareLatencies(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a;
+  uint64_t y = *(const uint64_t*) b;
+  return x < y ? -1 : x > y;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: loadgen [-t ip[:port]] [-b ip] [-r rate] [-d seconds] [-w ms] [-n name] [-s type.proto]\n"
+      "               [-q questions] [-u share] [-l share] [-k answers] [-m share] [-N names]\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  memset(&target, 0, sizeof(target));
+  target.sin_family = AF_INET;
+  target.sin_port = htons(MDNS_PORT);
+  target.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  struct sockaddr_in local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(0x7f000002);
+  double rate = 1000;
+  double seconds = 10;
+  unsigned wait = 1000;
+  char service[64] = "";
+  Mix mix = { "arduino", NULL, 1, 0, 0, 0, 0, 1000 };
+  int opt;
+  while ((opt = getopt(argc, argv, "t:b:r:d:w:n:s:q:u:l:k:m:N:")) != -1) {
+    switch (opt) {
+      case 't': if (!parseAddress(optarg, &target)) usage(); break;
+      case 'b': if (!parseAddress(optarg, &local)) usage(); break;
+      case 'r': rate = atof(optarg); break;
+      case 'd': seconds = atof(optarg); break;
+      case 'w': wait = atoi(optarg); break;
+      case 'n': mix.name = optarg; break;
+      case 's': snprintf(service, sizeof(service), "%s", optarg); mix.service = service; break;
+      case 'q': mix.questions = atoi(optarg); break;
+      case 'u': mix.unicast = share(optarg); break;
+      case 'l': mix.legacy = share(optarg); break;
+      case 'k': mix.knownAnswers = atoi(optarg); break;
+      case 'm': mix.misses = share(optarg); break;
+      case 'N': mix.names = atoi(optarg); break;
+      default: usage();
+    }
+  }
+  // IDs are reused after SLOTS queries, which must not be while answers to
+  // them may still come.
+  if (optind != argc || rate <= 0 || seconds <= 0 || rate * wait / 1000 >= SLOTS - 1 || mix.questions < 1
+      || mix.questions > 32 || mix.knownAnswers > 16 || mix.names < 1) {
+    usage();
+  }
+  timeout = (uint64_t) wait * 1000000;
+
+  for (int i = 0; i < 2; i++) {
+    sockets[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    int on = 1;
+    setsockopt(sockets[i], SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    local.sin_port = htons(i == 0 ? MDNS_PORT : 0);
+    if (sockets[i] < 0 || bind(sockets[i], (struct sockaddr*) &local, sizeof(local)) != 0) {
+      fail("cannot bind", strerror(errno));
+    }
+  }
+  unsigned long total = (unsigned long)(rate * seconds);
+  latencies = (uint64_t*) malloc((total + 1) * sizeof(uint64_t));
+  if (!latencies) {
+    fail("out of memory", NULL);
+  }
+  srand(nowNs());
+
+  uint64_t start = nowNs();
+  uint64_t end = 0;
+  struct pollfd waits[2] = { { sockets[0], POLLIN, 0 }, { sockets[1], POLLIN, 0 } };
+  uint16_t id = 0;
+  for (;;) {
+    uint64_t now = nowNs();
+    if (queries == total && end == 0) {
+      end = now;
+    }
+    if (end && now - end >= timeout) {
+      break;
+    }
+    // Send whatever is due, then wait for answers until the next one is.
+    uint64_t due = start + (uint64_t)(queries * 1e9 / rate);
+    while (queries < total && due <= now) {
+      uint8_t packet[MAX_PACKET];
+      size_t len;
+      bool legacy;
+      if (++id == 0) {
+        id = 1;
+      }
+      bool expect = buildQuery(mix, id, packet, &len, &legacy);
+      slots[id].sent = nowNs();
+      slots[id].expected = expect;
+      slots[id].answered = false;
+      if (sendto(sockets[legacy ? 1 : 0], packet, len, 0, (struct sockaddr*) &target, sizeof(target)) != (ssize_t) len) {
+        sendErrors++;
+        slots[id].sent = 0;
+      }
+      else if (expect) {
+        expected++;
+      }
+      queries++;
+      due = start + (uint64_t)(queries * 1e9 / rate);
+    }
+    uint64_t until = queries < total ? due : end + timeout;
+    now = nowNs();
+    int ms = until > now ? (int)((until - now) / 1000000) : 0;
+    if (poll(waits, 2, ms) > 0) {
+      receive(sockets[0]);
+      receive(sockets[1]);
+    }
+  }
+
+  double sending = (end - start) / 1e9;
+  printf("sent        %lu queries in %.2f s (%.0f/s), %lu expecting an answer", queries, sending,
+      queries / sending, expected);
+  if (sendErrors) {
+    printf(", %lu failed to send", sendErrors);
+  }
+  printf("\nanswered    %lu, %.3f%% dropped\n", answered, expected ? 100.0 * (expected - answered) / expected : 0.0);
+  printf("answers     %lu packets, %.3f per query, %lu to queries expecting none, %lu unmatched\n",
+      answerPackets, queries ? (double) answerPackets / queries : 0.0, unexpected, unmatched);
+  if (answered) {
+    qsort(latencies, answered, sizeof(uint64_t), compareLatencies);
+    printf("latency     p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n", latencies[answered / 2] / 1e3,
+        latencies[answered * 99 / 100] / 1e3, latencies[answered * 999 / 1000] / 1e3, latencies[answered - 1] / 1e3);
+  }
+  free(latencies);
+  return 0;
+}
@@ -0,0 +1,624 @@
+// Discrete-event simulation of many responders on one mDNS segment, to see
+// what a building full of boards does when it powers up at once.
+//
+//   netsim [-n nodes,...] [-c clients] [-r rate] [-B rate] [-s type.proto]
+//          [-d seconds] [-b ms] [-P ms] [-L ms] [-J ms] [-p loss] [-D dups]
+//          [-t ms] [-w ms] [-S seed]
+//
+// For each node count of -n, that many copies of the responder (simnode.so,
+// loaded once per node so that each has its own static state) boot at random
+// within the first -b ms, each as node-<i>.local advertising the -s service
+// with a TXT record, and have poll() called every -P ms. Once all of them are
+// up, each of -c clients resolves a random node's name -r times per second and
+// browses for the service -B times per second, for -d seconds.
+//
+// Frames share one 10 Mbit/s medium: they go out one after the other, as an
+// ideal half-duplex segment without collisions would send them. Every
+// receiver gets a frame -L ms after it has left plus up to -J ms at random,
+// unless it is lost, which happens with probability -p per receiver. The
+// clock is simulated, and with the same -S the results are the same on
+// every run.
+//
+// For each node count it reports the frames on the wire (and how many of
+// them were sent unprompted from poll(), i.e. announcements), their rate on
+// average and in the busiest -w ms, and the share of time the medium was
+// busy; the latency percentiles of the first answer to a resolve and the
+// share of resolves without one within -t ms; the answers a browse gets on
+// average and the median time to the last of them. -D of the nodes reuse the
+// name of another, and the names clients saw answered by more than one node
+// are counted. The responder does not probe for its names or resolve
+// conflicts (RFC 6762, sections 8 and 9), so there is no conflict resolution
+// time to report and it is shown as n/a.
+
+#include <dlfcn.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "simnode.h"
+
+#define MDNS_PORT 5353
+#define MAX_COUNTS 16
+#define MAX_PACKET 1458
+#define WIRE_NS_PER_BYTE 800  // 10 Mbit/s
+#define WIRE_OVERHEAD 24      // Preamble, CRC and inter-frame gap
+#define UDP_OVERHEAD 42       // Ethernet, IP and UDP headers
+
+#define TYPE_A 1
+#define TYPE_PTR 12
+#define CLASS_IN 1
+
+enum EventType { BOOT, POLL, DELIVER, RESOLVE, BROWSE };
+
+struct Packet {
+  uint32_t refs;
+  uint8_t srcIp[4];
+  uint16_t srcPort;
+  uint8_t dstIp[4];
+  uint16_t dstPort;
+  uint16_t len;
+  uint8_t data[MAX_PACKET];
+};
+
+struct Event {
+  uint64_t time;              // ns
+  uint64_t seq;               // Orders events at the same time
+  uint8_t type;
+  uint32_t target;            // Node, or client if at least nodeCount
+  Packet* packet;
+};
+
+struct Node {
+  NodeBegin begin;
+  NodeClock clock;
+  NodeReceive receive;
+  NodePoll poll;
+  bool up;
+};
+
+struct Client {
+  uint64_t* pending;          // Per name, when a resolve was sent, 0 if none
+  uint64_t browseStart;
+  uint32_t browseAnswers;
+  uint64_t browseLast;
+};
+
+static Node* nodes;
+static unsigned nodeCount;
+static unsigned nameCount;
+static Client* clients;
+static unsigned clientCount = 1;
+static const char* service = "_http._tcp";
+
+static Event* heap;
+static size_t heapSize;
+static size_t heapCapacity;
+static uint64_t seq;
+
+static uint64_t now;
+static uint64_t start;        // Of the queries
+static uint64_t end;
+static uint64_t mediumFree;
+static double resolveRate = 50;
+static double browseRate = 1;
+static uint64_t bootWindow = 1000000000;
+static uint64_t pollInterval = 10000000;
+static uint64_t latency = 100000;
+static uint64_t jitter = 50000;
+static double loss;
+static uint64_t timeout = 1000000000;
+
+static int current = -1;      // Node being run
+static bool polling;
+
+static unsigned long frames;
+static unsigned long unprompted;
+static uint64_t busy;
+static uint64_t* starts;      // Of every frame on the wire
+static size_t startCapacity;
+static unsigned long resolves;
+static uint64_t* latencies;
+static size_t latencyCount;
+static size_t latencyCapacity;
+static unsigned long browses;
+static unsigned long browseAnswers;
+static uint64_t* browseLast;
+static size_t browseLastCount;
+static int* answeredBy;       // Per name, the first node seen answering it
+static bool* conflict;
+
+static void fail(const char* message, const char* detail) {
+  fprintf(stderr, "netsim: %s%s%s\n", message, detail ? ": " : "", detail ? detail : "");
+  exit(1);
+}
+
+static void* grow(void* array, size_t* capacity, size_t size) {
+  *capacity = *capacity ? *capacity * 2 : 1024;
+  array = realloc(array, *capacity * size);
+  if (!array) {
+    fail("out of memory", NULL);
+  }
+  return array;
+}
+
+static bool chance(double p) {
+  return rand() < p * ((double) RAND_MAX + 1);
+}
+
+static uint64_t interval(double rate) {
+  double u = (rand() + 1.0) / ((double) RAND_MAX + 2.0);
+  return (uint64_t)(-log(u) / rate * 1e9);
+}
+
+static bool earlier(const Event& a, const Event& b) {
+  return a.time < b.time || (a.time == b.time && a.seq < b.seq);
+}
+
+static void schedule(uint64_t time, uint8_t type, uint32_t target, Packet* packet = NULL) {
+  if (heapSize == heapCapacity) {
+    heap = (Event*) grow(heap, &heapCapacity, sizeof(Event));
+  }
+  Event e = { time, seq++, type, target, packet };
+  size_t i = heapSize++;
+  while (i > 0 && earlier(e, heap[(i - 1) / 2])) {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i] = e;
+}
+
+static Event next() {
+  Event first = heap[0];
+  Event last = heap[--heapSize];
+  size_t i = 0;
+  while (2 * i + 1 < heapSize) {
+    size_t child = 2 * i + 1;
+    if (child + 1 < heapSize && earlier(heap[child + 1], heap[child])) {
+      child++;
+    }
+    if (!earlier(heap[child], last)) {
+      break;
+    }
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+  return first;
+}
+
+// Nodes are 10.1.x.y, clients 10.2.x.y, both numbered from 1.
+static void addressOf(uint32_t entity, uint8_t ip[4]) {
+  bool node = entity < nodeCount;
+  uint32_t n = (node ? entity : entity - nodeCount) + 1;
+  ip[0] = 10;
+  ip[1] = node ? 1 : 2;
+  ip[2] = n >> 8;
+  ip[3] = n;
+}
+
+static int entityAt(const uint8_t ip[4]) {
+  uint32_t n = ip[2] << 8 | ip[3];
+  if (ip[0] != 10 || n == 0) {
+    return -1;
+  }
+  if (ip[1] == 1 && n <= nodeCount) {
+    return n - 1;
+  }
+  if (ip[1] == 2 && n <= clientCount) {
+    return nodeCount + n - 1;
+  }
+  return -1;
+}
+
+// Puts a datagram on the medium and schedules it for its receivers: the
+// group is every node and client but the sender.
+static void transmit(uint32_t from, uint16_t srcPort, const uint8_t dstIp[4], uint16_t dstPort, const uint8_t* data,
+    uint16_t len) {
+  uint32_t bytes = (UDP_OVERHEAD + len < 60 ? 60 : UDP_OVERHEAD + len) + WIRE_OVERHEAD;
+  uint64_t sent = now > mediumFree ? now : mediumFree;
+  mediumFree = sent + (uint64_t) bytes * WIRE_NS_PER_BYTE;
+  busy += (uint64_t) bytes * WIRE_NS_PER_BYTE;
+  if (frames == startCapacity) {
+    starts = (uint64_t*) grow(starts, &startCapacity, sizeof(uint64_t));
+  }
+  starts[frames++] = sent;
+
+  Packet* packet = (Packet*) malloc(sizeof(Packet));
+  if (!packet) {
+    fail("out of memory", NULL);
+  }
+  packet->refs = 1;
+  addressOf(from, packet->srcIp);
+  packet->srcPort = srcPort;
+  memcpy(packet->dstIp, dstIp, 4);
+  packet->dstPort = dstPort;
+  packet->len = len;
+  memcpy(packet->data, data, len);
+
+  bool multicast = dstIp[0] >= 224 && dstIp[0] <= 239;
+  int to = multicast ? -1 : entityAt(dstIp);
+  for (uint32_t i = 0; i < nodeCount + clientCount; i++) {
+    if (i == from || (!multicast && (int) i != to) || chance(loss)) {
+      continue;
+    }
+    packet->refs++;
+    schedule(mediumFree + latency + (jitter ? (uint64_t) rand() % jitter : 0), DELIVER, i, packet);
+  }
+  if (--packet->refs == 0) {
+    free(packet);
+  }
+}
+
+static void onNodeSent(const HostPacket& packet) {
+  if (polling) {
+    unprompted++;
+  }
+  transmit(current, packet.srcPort, packet.dstIp, packet.dstPort, packet.data, packet.len);
+}
+
+static size_t putName(uint8_t* p, const char* name) {
+  size_t len = 0;
+  while (*name) {
+    const char* dot = strchr(name, '.');
+    size_t n = dot ? (size_t)(dot - name) : strlen(name);
+    p[len++] = n;
+    memcpy(p + len, name, n);
+    len += n;
+    name += dot ? n + 1 : n;
+  }
+  memcpy(p + len, "\5local", 7);
+  return len + 7;
+}
+
+static void sendQuery(uint32_t client, const char* name, uint16_t type) {
+  static const uint8_t group[4] = { 224, 0, 0, 251 };
+  uint8_t query[128] = { 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0 };
+  size_t len = 12 + putName(query + 12, name);
+  query[len++] = 0;
+  query[len++] = type;
+  query[len++] = 0;
+  query[len++] = CLASS_IN;
+  transmit(nodeCount + client, MDNS_PORT, group, MDNS_PORT, query, len);
+}
+
+static uint16_t skipName(const uint8_t* msg, uint16_t len, uint16_t pos) {
+  while (pos < len) {
+    if ((msg[pos] & 0xC0) == 0xC0) {
+      return pos + 2;
+    }
+    if (msg[pos] == 0) {
+      return pos + 1;
+    }
+    pos += 1 + msg[pos];
+  }
+  return len + 1;
+}
+
+// Looks at the first answer of a response from a node: an A record answers
+// the clients's resolves of the node's name, a PTR record its browse.
+static void clientReceive(uint32_t c, const Packet* packet) {
+  const uint8_t* msg = packet->data;
+  int node = entityAt(packet->srcIp);
+  if (packet->len < 12 || !(msg[2] & 0x80) || node < 0 || (unsigned) node >= nodeCount) {
+    return;
+  }
+  uint16_t pos = 12;
+  for (uint16_t i = msg[4] << 8 | msg[5]; i > 0; i--) {
+    pos = skipName(msg, packet->len, pos) + 4;
+  }
+  if ((msg[6] << 8 | msg[7]) == 0 || (pos = skipName(msg, packet->len, pos)) + 2 > packet->len) {
+    return;
+  }
+  uint16_t type = msg[pos] << 8 | msg[pos + 1];
+  Client& client = clients[c];
+  if (type == TYPE_A) {
+    uint32_t name = node % nameCount;
+    if (answeredBy[name] < 0) {
+      answeredBy[name] = node;
+    }
+    else if (answeredBy[name] != node) {
+      conflict[name] = true;
+    }
+    if (client.pending[name] && now - client.pending[name] <= timeout) {
+      if (latencyCount == latencyCapacity) {
+        latencies = (uint64_t*) grow(latencies, &latencyCapacity, sizeof(uint64_t));
+      }
+      latencies[latencyCount++] = now - client.pending[name];
+      client.pending[name] = 0;
+    }
+  }
+  else if (type == TYPE_PTR && client.browseStart && now - client.browseStart <= timeout) {
+    client.browseAnswers++;
+    client.browseLast = now;
+  }
+}
+
+// Counts the answers to a client's last browse once it is over.
+static void endBrowse(Client& client) {
+  if (!client.browseStart) {
+    return;
+  }
+  browseAnswers += client.browseAnswers;
+  if (client.browseAnswers) {
+    browseLast[browseLastCount++] = client.browseLast - client.browseStart;
+  }
+  client.browseStart = 0;
+}
+
+static void handle(const Event& e) {
+  now = e.time;
+  if (e.target >= nodeCount) {
+    uint32_t c = e.target - nodeCount;
+    Client& client = clients[c];
+    if (e.type == DELIVER) {
+      clientReceive(c, e.packet);
+    }
+    else if (e.type == RESOLVE && now < end) {
+      uint32_t name = rand() % nameCount;
+      char text[16];
+      snprintf(text, sizeof(text), "node-%u", name);
+      if (!client.pending[name] || now - client.pending[name] > timeout) {
+        client.pending[name] = now;
+        resolves++;
+      }
+      sendQuery(c, text, TYPE_A);
+      schedule(now + interval(resolveRate), RESOLVE, e.target);
+    }
+    else if (e.type == BROWSE && now < end) {
+      endBrowse(client);
+      client.browseStart = now;
+      client.browseAnswers = 0;
+      browses++;
+      sendQuery(c, service, TYPE_PTR);
+      schedule(now + interval(browseRate), BROWSE, e.target);
+    }
+  }
+  else {
+    Node& node = nodes[e.target];
+    current = e.target;
+    node.clock(now / 1000);
+    if (e.type == BOOT) {
+      char name[16];
+      uint8_t ip[4];
+      snprintf(name, sizeof(name), "node-%u", e.target % nameCount);
+      addressOf(e.target, ip);
+      if (!node.begin(name, ip, service, onNodeSent)) {
+        fail("a node did not start, is the library built with MDNS_ENABLE_SERVICES?", service);
+      }
+      node.up = true;
+      schedule(now + (uint64_t) rand() % pollInterval, POLL, e.target);
+    }
+    else if (e.type == POLL && now < end) {
+      polling = true;
+      node.poll();
+      polling = false;
+      schedule(now + pollInterval, POLL, e.target);
+    }
+    else if (e.type == DELIVER && node.up) {
+      const Packet* p = e.packet;
+      node.receive(p->srcIp, p->srcPort, p->dstIp, p->dstPort, p->data, p->len);
+    }
+    current = -1;
+  }
+  if (e.packet && --e.packet->refs == 0) {
+    free(e.packet);
+  }
+}
+
+static int compare(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a;
+  uint64_t y = *(const uint64_t*) b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(uint64_t* values, size_t count, unsigned per1000) {
+  return count ? values[count * per1000 / 1000 < count ? count * per1000 / 1000 : count - 1] / 1e6 : 0;
+}
+
+static void run(unsigned count, unsigned dups, double seconds, uint64_t window, unsigned seed) {
+  srand(seed);
+  nodeCount = count;
+  nameCount = count - dups;
+  now = mediumFree = 0;
+  frames = unprompted = resolves = browses = browseAnswers = 0;
+  busy = 0;
+  latencyCount = browseLastCount = 0;
+  for (unsigned i = 0; i < nameCount; i++) {
+    answeredBy[i] = -1;
+    conflict[i] = false;
+  }
+  for (unsigned i = 0; i < count; i++) {
+    nodes[i].up = false;
+    schedule((uint64_t) rand() % bootWindow, BOOT, i);
+  }
+  start = bootWindow;
+  end = start + (uint64_t)(seconds * 1e9);
+  for (unsigned c = 0; c < clientCount; c++) {
+    memset(clients[c].pending, 0, nameCount * sizeof(uint64_t));
+    clients[c].browseStart = 0;
+    if (resolveRate > 0) {
+      schedule(start + interval(resolveRate), RESOLVE, nodeCount + c);
+    }
+    if (browseRate > 0 && service) {
+      schedule(start + interval(browseRate), BROWSE, nodeCount + c);
+    }
+  }
+  browseLast = (uint64_t*) realloc(browseLast, (size_t)(browseRate * seconds * 2 + 100) * clientCount * sizeof(uint64_t));
+  if (!browseLast) {
+    fail("out of memory", NULL);
+  }
+  while (heapSize > 0) {
+    handle(next());
+  }
+  unsigned long answered = latencyCount;
+  for (unsigned c = 0; c < clientCount; c++) {
+    endBrowse(clients[c]);
+  }
+
+  // The most frames that started within one window
+  unsigned long peak = 0;
+  for (size_t i = 0, j = 0; j < frames; j++) {
+    while (starts[j] - starts[i] >= window) {
+      i++;
+    }
+    if (j - i + 1 > peak) {
+      peak = j - i + 1;
+    }
+  }
+  unsigned conflicts = 0;
+  for (unsigned i = 0; i < nameCount; i++) {
+    conflicts += conflict[i];
+  }
+  qsort(latencies, latencyCount, sizeof(uint64_t), compare);
+  qsort(browseLast, browseLastCount, sizeof(uint64_t), compare);
+  double total = now / 1e9;
+  printf("%6u %8lu %8lu %9.1f %9.0f %6.2f%% %8.2f %8.2f %8.2f %6.2f%% %7.1f %8.2f %5u      n/a\n", count, frames,
+      unprompted, frames / total, peak * 1e9 / window, 100.0 * busy / now, percentile(latencies, latencyCount, 500),
+      percentile(latencies, latencyCount, 990), percentile(latencies, latencyCount, 1000),
+      resolves ? 100.0 * (resolves - answered) / resolves : 0.0, browses ? (double) browseAnswers / browses : 0.0,
+      percentile(browseLast, browseLastCount, 500), conflicts);
+}
+
+// Loads a copy of the node library of its own. dlopen() loads a path only
+// once, so each copy goes to a file of its own first, which can go again
+// once it is loaded.
+static void load(Node& node, const char* dir, unsigned index, const uint8_t* image, size_t size) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/node-%u.so", dir, index);
+  FILE* file = fopen(path, "wb");
+  if (!file || fwrite(image, 1, size, file) != size || fclose(file) != 0) {
+    fail("cannot write", path);
+  }
+  void* library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  unlink(path);
+  if (!library) {
+    fail("cannot load simnode.so", dlerror());
+  }
+  node.begin = (NodeBegin) dlsym(library, "nodeBegin");
+  node.clock = (NodeClock) dlsym(library, "nodeClock");
+  node.receive = (NodeReceive) dlsym(library, "nodeReceive");
+  node.poll = (NodePoll) dlsym(library, "nodePoll");
+  if (!node.begin || !node.clock || !node.receive || !node.poll) {
+    fail("missing functions in", "simnode.so");
+  }
+}
+
+// Reads simnode.so from next to the executable.
+static uint8_t* readLibrary(size_t* size) {
+  char path[4096];
+  ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 16);
+  if (n < 0) {
+    fail("cannot find", "/proc/self/exe");
+  }
+  path[n] = 0;
+  char* slash = strrchr(path, '/');
+  strcpy(slash ? slash + 1 : path, "simnode.so");
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    fail("cannot open", path);
+  }
+  uint8_t* image = NULL;
+  size_t capacity = 0;
+  *size = 0;
+  while (!feof(file)) {
+    if (*size == capacity) {
+      image = (uint8_t*) grow(image, &capacity, 1);
+    }
+    *size += fread(image + *size, 1, capacity - *size, file);
+  }
+  fclose(file);
+  return image;
+}
+
+static double milliseconds(const char* text) {
+  double v = atof(text);
+  return v < 0 ? 0 : v * 1e6;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: netsim [-n nodes,...] [-c clients] [-r rate] [-B rate] [-s type.proto] [-d seconds] [-b ms]\n"
+      "              [-P ms] [-L ms] [-J ms] [-p loss] [-D dups] [-t ms] [-w ms] [-S seed]\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  unsigned counts[MAX_COUNTS] = { 10, 50, 100, 200, 500 };
+  unsigned countCount = 5;
+  double seconds = 10;
+  unsigned dups = 0;
+  uint64_t window = 10000000;
+  unsigned seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:c:r:B:s:d:b:P:L:J:p:D:t:w:S:")) != -1) {
+    switch (opt) {
+      case 'n':
+        countCount = 0;
+        for (char* p = optarg; *p && countCount < MAX_COUNTS; p += *p == ',') {
+          char* next;
+          counts[countCount++] = strtoul(p, &next, 10);
+          if (next == p || counts[countCount - 1] == 0 || counts[countCount - 1] > 65000) {
+            usage();
+          }
+          p = next;
+        }
+        break;
+      case 'c': clientCount = atoi(optarg); break;
+      case 'r': resolveRate = atof(optarg); break;
+      case 'B': browseRate = atof(optarg); break;
+      case 's': service = *optarg ? optarg : NULL; break;
+      case 'd': seconds = atof(optarg); break;
+      case 'b': bootWindow = milliseconds(optarg); break;
+      case 'P': pollInterval = milliseconds(optarg); break;
+      case 'L': latency = milliseconds(optarg); break;
+      case 'J': jitter = milliseconds(optarg); break;
+      case 'p': loss = atof(optarg); break;
+      case 'D': dups = atoi(optarg); break;
+      case 't': timeout = milliseconds(optarg); break;
+      case 'w': window = milliseconds(optarg); break;
+      case 'S': seed = atoi(optarg); break;
+      default: usage();
+    }
+  }
+  unsigned most = 0;
+  for (unsigned i = 0; i < countCount; i++) {
+    if (counts[i] <= dups) {
+      usage();
+    }
+    most = counts[i] > most ? counts[i] : most;
+  }
+  if (optind != argc || clientCount < 1 || clientCount > 65000 || resolveRate < 0 || browseRate < 0 || seconds <= 0
+      || bootWindow == 0 || pollInterval == 0 || loss < 0 || loss > 1 || window == 0) {
+    usage();
+  }
+
+  size_t size;
+  uint8_t* image = readLibrary(&size);
+  nodes = (Node*) calloc(most, sizeof(Node));
+  clients = (Client*) calloc(clientCount, sizeof(Client));
+  answeredBy = (int*) calloc(most, sizeof(int));
+  conflict = (bool*) calloc(most, sizeof(bool));
+  if (!nodes || !clients || !answeredBy || !conflict) {
+    fail("out of memory", NULL);
+  }
+  char dir[] = "/tmp/netsim-XXXXXX";
+  if (!mkdtemp(dir)) {
+    fail("cannot make a directory in", "/tmp");
+  }
+  for (unsigned i = 0; i < most; i++) {
+    load(nodes[i], dir, i, image, size);
+  }
+  rmdir(dir);
+  free(image);
+  for (unsigned c = 0; c < clientCount; c++) {
+    clients[c].pending = (uint64_t*) calloc(most, sizeof(uint64_t));
+    if (!clients[c].pending) {
+      fail("out of memory", NULL);
+    }
+  }
+
+  printf(" nodes   frames  unprompt  frames/s    peak/s medium   p50 ms   p99 ms   max ms   lost  browse  last ms  dups conflict\n");
+  for (unsigned i = 0; i < countCount; i++) {
+    run(counts[i], dups, seconds, window, seed);
+  }
+  return 0;
+}
@@ -0,0 +1,102 @@
+// The query mix of loadgen, shared with the tools that send it through the
+// host stub instead of a socket.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "query.h"
+
+#define TYPE_A 1
+#define TYPE_PTR 12
+#define CLASS_IN 1
+#define CLASS_QU 0x8000
+
+double share(const char* text) {
+  double v = atof(text);
+  return v < 0 ? 0 : v > 1 ? 1 : v;
+}
+
+bool chance(double p) {
+  return rand() < p * ((double) RAND_MAX + 1);
+}
+
+static size_t put16(uint8_t* p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v;
+  return 2;
+}
+
+// Writes name (dotted) followed by "local".
+static size_t putName(uint8_t* p, const char* name) {
+  size_t len = 0;
+  while (*name) {
+    const char* dot = strchr(name, '.');
+    size_t n = dot ? (size_t)(dot - name) : strlen(name);
+    p[len++] = n;
+    memcpy(p + len, name, n);
+    len += n;
+    name += dot ? n + 1 : n;
+  }
+  memcpy(p + len, "\5local", 7);
+  return len + 7;
+}
+
+bool buildQuery(const Mix& mix, uint16_t id, uint8_t* packet, size_t* len, bool* legacy) {
+  bool hit = !chance(mix.misses);
+  unsigned count = 1 + rand() % mix.questions;
+  unsigned hitAt = rand() % count;
+  uint16_t cls = chance(mix.unicast) ? CLASS_IN | CLASS_QU : CLASS_IN;
+  *legacy = chance(mix.legacy);
+
+  size_t pos = put16(packet, id);
+  pos += put16(packet + pos, 0);
+  pos += put16(packet + pos, count);
+  pos += put16(packet + pos, mix.knownAnswers);
+  pos += put16(packet + pos, 0);
+  pos += put16(packet + pos, 0);
+  uint16_t browse = 0;
+  for (unsigned i = 0; i < count; i++) {
+    char name[64];
+    uint16_t type = TYPE_A;
+    if (hit && i == hitAt) {
+      if (mix.service && rand() % 2) {
+        snprintf(name, sizeof(name), "%s", mix.service);
+        type = TYPE_PTR;
+      }
+      else {
+        snprintf(name, sizeof(name), "%s", mix.name);
+      }
+    }
+    else {
+      snprintf(name, sizeof(name), "miss-%u", (unsigned) rand() % mix.names);
+    }
+    if (type == TYPE_PTR) {
+      browse = pos;
+    }
+    pos += putName(packet + pos, name);
+    pos += put16(packet + pos, type);
+    pos += put16(packet + pos, cls);
+  }
+
+  // Known PTR answers for instances that do not exist, on the service type
+  // if it was asked for, else on the first question.
+  for (unsigned i = 0; i < mix.knownAnswers; i++) {
+    char instance[24];
+    snprintf(instance, sizeof(instance), "known-%u", i);
+    pos += put16(packet + pos, 0xC000 | (browse ? browse : 12));
+    pos += put16(packet + pos, TYPE_PTR);
+    pos += put16(packet + pos, CLASS_IN);
+    pos += put16(packet + pos, 0);
+    pos += put16(packet + pos, 4500);
+    size_t rdlength = pos;
+    pos += 2;
+    size_t n = strlen(instance);
+    packet[pos++] = n;
+    memcpy(packet + pos, instance, n);
+    pos += n;
+    pos += put16(packet + pos, 0xC000 | (browse ? browse : 12));
+    put16(packet + rdlength, pos - rdlength - 2);
+  }
+  *len = pos;
+  return hit;
+}
@@ -0,0 +1,31 @@
+// A mix of mDNS queries, as loadgen sends them: see there for what the
+// fields mean.
+
+#ifndef HostQuery_h
+#define HostQuery_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct Mix {
+  const char* name;
+  const char* service;
+  unsigned questions;
+  double unicast;
+  double legacy;
+  unsigned knownAnswers;
+  double misses;
+  unsigned names;
+};
+
+// A share given on the command line, clamped to 0..1
+double share(const char* text);
+
+// True with probability p, from rand()
+bool chance(double p);
+
+// Builds a query with the given ID. Sets *legacy if it is to be sent as a
+// legacy resolver and returns whether an answer is expected.
+bool buildQuery(const Mix& mix, uint16_t id, uint8_t* packet, size_t* len, bool* legacy);
+
+#endif
@@ -0,0 +1,559 @@
+// Replays the mDNS traffic in a pcap or pcapng capture through the responder.
+//
+//   replay [-r] [-l laps] [-n name] [-a ip] [-s type.proto]... [-w out.pcap]
+//          [-x slowest.bin] capture
+//
+// Every IPv4 UDP datagram to port 5353 is handed to onUdpReceive() with its
+// source addresses, as fast as possible or, with -r, at capture speed. The
+// responder's clock follows the capture timestamps either way, and poll() is
+// run in between. Everything the responder sends is counted and, with -w,
+// written to a capture of its own. At the end it prints the packets per
+// second the handler can take, responses per query and the time spent in
+// onUdpReceive() per packet and per byte. -x saves the slowest payload, e.g.
+// as a seed for fuzz.
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "EC_MDNSResponder.h"
+#include "tool.h"
+
+#define MDNS_PORT 5353
+#define POLL_STEP 10000       // us of capture time between poll() calls
+#define MAX_SENT 16           // Responses kept per delivered packet
+#define START 1000000         // Responder clock at the first packet, us
+
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_LINUX_SLL2 276
+
+struct Packet {
+  uint64_t time;              // us since the first packet
+  uint8_t srcMac[6];
+  uint8_t srcIp[4];
+  uint8_t dstIp[4];
+  uint16_t srcPort;
+  uint16_t len;
+  uint8_t* data;
+};
+
+static Packet* packets;
+static size_t packetCount;
+static size_t packetSize;
+static uint64_t captureStart = UINT64_MAX;  // Timestamp of the first packet, us
+
+// Responses sent while a packet was handled, copied out of Ethernet::buffer
+// and written after the clock is stopped.
+static struct {
+  uint8_t dstMac[6];
+  uint8_t dstIp[4];
+  uint16_t srcPort;
+  uint16_t dstPort;
+  uint16_t len;
+  uint8_t data[HOST_BUFFER_SIZE];
+} sent[MAX_SENT];
+static uint8_t sentCount;
+static unsigned long responses;
+static unsigned long responseBytes;
+static FILE* out;
+
+static void fail(const char* message, const char* detail) {
+  fprintf(stderr, "replay: %s%s%s\n", message, detail ? ": " : "", detail ? detail : "");
+  exit(1);
+}
+
+static uint16_t get16(const uint8_t* p, bool swap) {
+  return swap ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+}
+
+static uint32_t get32(const uint8_t* p, bool swap) {
+  return swap ? ((uint32_t)get16(p, true) << 16 | get16(p + 2, true))
+      : ((uint32_t)get16(p + 2, false) << 16 | get16(p, false));
+}
+
+static uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Keeps the datagram in frame if it is IPv4/UDP to port 5353. time is in us.
+static void addFrame(uint32_t linkType, uint64_t time, const uint8_t* frame, uint32_t len) {
+  static const uint8_t noMac[6] = { 0 };
+  const uint8_t* mac = noMac;
+  uint16_t protocol = 0x0800;
+  switch (linkType) {
+    case LINKTYPE_ETHERNET:
+      if (len < 14) {
+        return;
+      }
+      mac = frame + 6;
+      protocol = frame[12] << 8 | frame[13];
+      frame += 14;
+      len -= 14;
+      // 802.1Q and 802.1ad tags
+      while ((protocol == 0x8100 || protocol == 0x88a8) && len >= 4) {
+        protocol = frame[2] << 8 | frame[3];
+        frame += 4;
+        len -= 4;
+      }
+      break;
+    case LINKTYPE_LINUX_SLL:
+      if (len < 16) {
+        return;
+      }
+      if ((frame[4] << 8 | frame[5]) == 6) {
+        mac = frame + 6;
+      }
+      protocol = frame[14] << 8 | frame[15];
+      frame += 16;
+      len -= 16;
+      break;
+    case LINKTYPE_LINUX_SLL2:
+      if (len < 20) {
+        return;
+      }
+      if (frame[11] == 6) {
+        mac = frame + 12;
+      }
+      protocol = frame[0] << 8 | frame[1];
+      frame += 20;
+      len -= 20;
+      break;
+    case LINKTYPE_NULL:
+      if (len < 4 || (frame[0] != 2 && frame[3] != 2)) {
+        return;
+      }
+      frame += 4;
+      len -= 4;
+      break;
+    case LINKTYPE_RAW:
+      break;
+    default:
+      return;
+  }
+
+  // IPv4, unfragmented, UDP
+  if (protocol != 0x0800 || len < 20 || (frame[0] >> 4) != 4) {
+    return;
+  }
+  uint16_t headerLen = (frame[0] & 0x0f) * 4;
+  uint16_t totalLen = frame[2] << 8 | frame[3];
+  if (headerLen < 20 || totalLen < headerLen + 8 || totalLen > len
+      || ((frame[6] & 0x3f) | frame[7]) != 0 || frame[9] != 17) {
+    return;
+  }
+  const uint8_t* udp = frame + headerLen;
+  uint16_t udpLen = udp[4] << 8 | udp[5];
+  if ((udp[2] << 8 | udp[3]) != MDNS_PORT || udpLen < 8 || udpLen > totalLen - headerLen
+      || udpLen - 8 > HOST_BUFFER_SIZE - UDP_DATA_P) {
+    return;
+  }
+
+  if (packetCount == packetSize) {
+    packetSize = packetSize ? packetSize * 2 : 1024;
+    packets = (Packet*) realloc(packets, packetSize * sizeof(Packet));
+    if (!packets) {
+      fail("out of memory", NULL);
+    }
+  }
+  if (captureStart == UINT64_MAX) {
+    captureStart = time;
+  }
+  Packet& p = packets[packetCount++];
+  // Out of order timestamps are replayed as if simultaneous.
+  p.time = time > captureStart ? time - captureStart : 0;
+  if (packetCount > 1 && p.time < packets[packetCount - 2].time) {
+    p.time = packets[packetCount - 2].time;
+  }
+  memcpy(p.srcMac, mac, 6);
+  memcpy(p.srcIp, frame + 12, 4);
+  memcpy(p.dstIp, frame + 16, 4);
+  p.srcPort = udp[0] << 8 | udp[1];
+  p.len = udpLen - 8;
+  p.data = (uint8_t*) malloc(p.len ? p.len : 1);
+  if (!p.data) {
+    fail("out of memory", NULL);
+  }
+  memcpy(p.data, udp + 8, p.len);
+}
+
+static void readPcap(FILE* f, const uint8_t* header) {
+  uint8_t rest[20];
+  if (fread(rest, 1, sizeof(rest), f) != sizeof(rest)) {
+    fail("truncated pcap header", NULL);
+  }
+  bool swap = header[0] == 0xa1;
+  bool nanoseconds = header[swap ? 2 : 1] == 0x3c;
+  uint32_t linkType = get32(rest + 16, swap) & 0xffff;
+
+  uint8_t record[16];
+  uint8_t* frame = (uint8_t*) malloc(65536);
+  while (fread(record, 1, sizeof(record), f) == sizeof(record)) {
+    uint32_t captured = get32(record + 8, swap);
+    if (captured > 65536 || fread(frame, 1, captured, f) != captured) {
+      fail("truncated or corrupt pcap record", NULL);
+    }
+    uint32_t fraction = get32(record + 4, swap);
+    uint64_t time = (uint64_t)get32(record, swap) * 1000000 + (nanoseconds ? fraction / 1000 : fraction);
+    addFrame(linkType, time, frame, captured);
+  }
+  free(frame);
+}
+
+static void readPcapng(FILE* f, const uint8_t* header) {
+  // Link type and timestamp resolution (units per second) per interface
+  uint32_t linkTypes[16];
+  uint64_t units[16];
+  uint8_t interfaces = 0;
+  bool swap = false;
+  uint64_t lastTime = 0;
+
+  uint8_t* block = NULL;
+  uint32_t blockSize = 0;
+  uint8_t start[8];
+  memcpy(start, header, 4);
+  bool haveType = true;
+  for (;;) {
+    if (haveType ? fread(start + 4, 1, 4, f) != 4 : fread(start, 1, 8, f) != 8) {
+      break;
+    }
+    haveType = false;
+    uint32_t type = get32(start, swap);
+    uint32_t length;
+    if (type == 0x0a0d0d0a) {
+      // A section header sets the byte order for everything after it.
+      uint8_t magic[4];
+      if (fread(magic, 1, 4, f) != 4) {
+        fail("truncated pcapng section header", NULL);
+      }
+      swap = magic[0] == 0x1a;
+      length = get32(start + 4, swap);
+      if (length < 28) {
+        fail("corrupt pcapng section header", NULL);
+      }
+      if (fseek(f, length - 12, SEEK_CUR) != 0) {
+        fail("truncated pcapng section header", NULL);
+      }
+      interfaces = 0;
+      continue;
+    }
+    length = get32(start + 4, swap);
+    if (length < 12 || length % 4 != 0) {
+      fail("corrupt pcapng block", NULL);
+    }
+    if (length - 8 > blockSize) {
+      blockSize = length - 8;
+      block = (uint8_t*) realloc(block, blockSize);
+      if (!block) {
+        fail("out of memory", NULL);
+      }
+    }
+    if (fread(block, 1, length - 8, f) != length - 8) {
+      fail("truncated pcapng block", NULL);
+    }
+    uint32_t body = length - 12;
+
+    if (type == 1 && body >= 8) {
+      // Interface description, with the if_tsresol option if present
+      if (interfaces == 16) {
+        fail("too many interfaces", NULL);
+      }
+      linkTypes[interfaces] = get16(block, swap);
+      units[interfaces] = 1000000;
+      for (uint32_t pos = 8; pos + 4 <= body; ) {
+        uint16_t code = get16(block + pos, swap);
+        uint16_t size = get16(block + pos + 2, swap);
+        if (code == 0) {
+          break;
+        }
+        if (code == 9 && size == 1 && pos + 5 <= body) {
+          uint8_t resolution = block[pos + 4];
+          uint64_t u = 1;
+          for (uint8_t i = 0; i < (resolution & 0x7f) && u < UINT64_MAX / 10; i++) {
+            u *= (resolution & 0x80) ? 2 : 10;
+          }
+          units[interfaces] = u;
+        }
+        pos += 4 + ((size + 3) & ~3);
+      }
+      interfaces++;
+    } else if (type == 6 && body >= 20) {
+      // Enhanced packet
+      uint32_t interface = get32(block, swap);
+      uint32_t captured = get32(block + 12, swap);
+      if (interface >= interfaces || captured > body - 20) {
+        fail("corrupt pcapng packet block", NULL);
+      }
+      uint64_t ticks = (uint64_t)get32(block + 4, swap) << 32 | get32(block + 8, swap);
+      uint64_t u = units[interface];
+      lastTime = u == 1000000 ? ticks : (uint64_t)((long double)ticks * 1000000 / u);
+      addFrame(linkTypes[interface], lastTime, block + 20, captured);
+    } else if (type == 3 && body >= 4 && interfaces > 0) {
+      // Simple packet: no timestamp, taken to follow the previous one
+      uint32_t captured = get32(block, swap);
+      if (captured > body - 4) {
+        captured = body - 4;
+      }
+      addFrame(linkTypes[0], lastTime, block + 4, captured);
+    }
+  }
+  free(block);
+}
+
+static void readCapture(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    fail(path, strerror(errno));
+  }
+  uint8_t magic[4];
+  if (fread(magic, 1, 4, f) != 4) {
+    fail("not a capture file", path);
+  }
+  uint32_t m = (uint32_t)magic[0] << 24 | magic[1] << 16 | magic[2] << 8 | magic[3];
+  if (m == 0xa1b2c3d4 || m == 0xd4c3b2a1 || m == 0xa1b23c4d || m == 0x4d3cb2a1) {
+    readPcap(f, magic);
+  } else if (m == 0x0a0d0d0a) {
+    readPcapng(f, magic);
+  } else {
+    fail("not a pcap or pcapng file", path);
+  }
+  fclose(f);
+}
+
+static void put16(uint8_t* p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+static void put32le(uint8_t* p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void writeHeader() {
+  uint8_t header[24] = { 0xd4, 0xc3, 0xb2, 0xa1, 2, 0, 4, 0 };
+  put32le(header + 16, 65535);
+  put32le(header + 20, LINKTYPE_ETHERNET);
+  fwrite(header, 1, sizeof(header), out);
+}
+
+// Writes one response as an Ethernet frame sent at capture time us.
+static void writeResponse(uint64_t time, uint8_t i) {
+  uint8_t frame[42];
+  uint16_t len = sent[i].len;
+  memcpy(frame, sent[i].dstMac, 6);
+  memcpy(frame + 6, EtherCard::mymac, 6);
+  put16(frame + 12, 0x0800);
+  uint8_t* ip = frame + 14;
+  memset(ip, 0, 20);
+  ip[0] = 0x45;
+  put16(ip + 2, 28 + len);
+  ip[8] = 255;
+  ip[9] = 17;
+  memcpy(ip + 12, EtherCard::myip, 4);
+  memcpy(ip + 16, sent[i].dstIp, 4);
+  uint32_t sum = 0;
+  for (uint8_t j = 0; j < 20; j += 2) {
+    sum += ip[j] << 8 | ip[j + 1];
+  }
+  sum = (sum & 0xffff) + (sum >> 16);
+  put16(ip + 10, ~(sum + (sum >> 16)));
+  uint8_t* udp = ip + 20;
+  put16(udp, sent[i].srcPort);
+  put16(udp + 2, sent[i].dstPort);
+  put16(udp + 4, 8 + len);
+  put16(udp + 6, 0);
+
+  uint8_t record[16];
+  put32le(record, time / 1000000);
+  put32le(record + 4, time % 1000000);
+  put32le(record + 8, sizeof(frame) + len);
+  put32le(record + 12, sizeof(frame) + len);
+  fwrite(record, 1, sizeof(record), out);
+  fwrite(frame, 1, sizeof(frame), out);
+  fwrite(sent[i].data, 1, len, out);
+}
+
+static void onSent(const HostPacket& packet) {
+  responses++;
+  responseBytes += packet.len;
+  if (sentCount < MAX_SENT) {
+    memcpy(sent[sentCount].dstMac, packet.dstMac, 6);
+    memcpy(sent[sentCount].dstIp, packet.dstIp, 4);
+    sent[sentCount].srcPort = packet.srcPort;
+    sent[sentCount].dstPort = packet.dstPort;
+    sent[sentCount].len = packet.len;
+    memcpy(sent[sentCount].data, packet.data, packet.len);
+    sentCount++;
+  }
+}
+
+static void flushSent() {
+  if (out) {
+    for (uint8_t i = 0; i < sentCount; i++) {
+      writeResponse(captureStart + hostMicros - START, i);
+    }
+  }
+  sentCount = 0;
+}
+
+static int compareTimes(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a;
+  uint64_t y = *(const uint64_t*) b;
+  return x < y ? -1 : x > y;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: replay [-r] [-l laps] [-n name] [-a ip] [-s type.proto]... [-w out.pcap] [-x slowest.bin] capture\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  bool realtime = false;
+  unsigned laps = 1;
+  const char* name = "arduino";
+  const char* services[8];
+  uint8_t serviceCount = 0;
+  const char* outPath = NULL;
+  const char* slowPath = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "rl:n:a:s:w:x:")) != -1) {
+    switch (opt) {
+      case 'r': realtime = true; break;
+      case 'l': laps = atoi(optarg); break;
+      case 'n': name = optarg; break;
+      case 'a': if (!parseAddress(optarg, EtherCard::myip, NULL)) usage(); break;
+      case 's': if (serviceCount == 8) usage(); services[serviceCount++] = optarg; break;
+      case 'w': outPath = optarg; break;
+      case 'x': slowPath = optarg; break;
+      default: usage();
+    }
+  }
+  if (optind != argc - 1 || laps == 0) {
+    usage();
+  }
+  readCapture(argv[optind]);
+  if (packetCount == 0) {
+    fail("no IPv4 UDP packets to port 5353 in", argv[optind]);
+  }
+
+  hostMicros = START;
+  if (!EC_MDNSResponder::begin(name, ether)) {
+    fail("begin() failed for", name);
+  }
+  for (uint8_t i = 0; i < serviceCount; i++) {
+    if (!addService(services[i], 80)) {
+      fail("cannot add service", services[i]);
+    }
+  }
+  if (outPath) {
+    out = fopen(outPath, "wb");
+    if (!out) {
+      fail(outPath, strerror(errno));
+    }
+    writeHeader();
+  }
+  hostSent = onSent;
+  // Whatever begin() and addService() announced is not a response to the capture.
+  EC_MDNSResponder::poll();
+  flushSent();
+  responses = 0;
+  responseBytes = 0;
+
+  unsigned long queries = 0;
+  unsigned long bytes = 0;
+  uint64_t handlerNs = 0;
+  uint64_t* times = (uint64_t*) malloc(packetCount * laps * sizeof(uint64_t));
+  if (!times) {
+    fail("out of memory", NULL);
+  }
+  uint64_t maxNs = 0;
+  size_t slowest = 0;
+  uint64_t start = nowNs();
+  uint64_t duration = packets[packetCount - 1].time + 1000000;
+  for (unsigned lap = 0; lap < laps; lap++) {
+    for (size_t i = 0; i < packetCount; i++) {
+      const Packet& p = packets[i];
+      uint64_t due = START + lap * duration + p.time;
+      if (realtime) {
+        uint64_t wall = (due - START) * 1000;
+        uint64_t elapsed = nowNs() - start;
+        if (wall > elapsed) {
+          struct timespec ts = { (time_t)((wall - elapsed) / 1000000000), (long)((wall - elapsed) % 1000000000) };
+          nanosleep(&ts, NULL);
+        }
+      }
+      // Let poll() see the time go by, in steps a loop() would take.
+      while (due - hostMicros > POLL_STEP) {
+        hostMicros += POLL_STEP;
+        EC_MDNSResponder::poll();
+        flushSent();
+      }
+      hostMicros = due;
+
+      if (p.len >= 3 && (p.data[2] & 0x80) == 0) {
+        queries++;
+      }
+      bytes += p.len;
+      uint64_t t = nowNs();
+      hostReceive(p.srcMac, p.srcIp, p.srcPort, p.dstIp, MDNS_PORT, p.data, p.len);
+      t = nowNs() - t;
+      handlerNs += t;
+      times[lap * packetCount + i] = t;
+      if (t > maxNs) {
+        maxNs = t;
+        slowest = i;
+      }
+      flushSent();
+      EC_MDNSResponder::poll();
+      flushSent();
+    }
+  }
+  uint64_t wallNs = nowNs() - start;
+  unsigned long delivered = packetCount * laps;
+
+  printf("capture        %s\n", argv[optind]);
+  printf("packets        %lu to port 5353 (%lu queries) in %.3f s of capture", delivered, queries,
+      packets[packetCount - 1].time / 1e6);
+  if (laps > 1) {
+    printf(", %u laps", laps);
+  }
+  printf("\nreplayed in    %.3f s, %.0f packets/s\n", wallNs / 1e9, delivered / (wallNs / 1e9));
+  printf("responses      %lu (%lu bytes), %.3f per query\n", responses, responseBytes,
+      queries ? (double) responses / queries : 0.0);
+  printf("onUdpReceive   %.3f s in all, %.0f packets/s\n", handlerNs / 1e9, delivered / (handlerNs / 1e9));
+  qsort(times, delivered, sizeof(uint64_t), compareTimes);
+  printf("per packet     min %llu ns, avg %.0f ns, p50 %llu ns, p99 %llu ns, max %llu ns\n",
+      (unsigned long long) times[0], (double) handlerNs / delivered, (unsigned long long) times[delivered / 2],
+      (unsigned long long) times[delivered * 99 / 100], (unsigned long long) maxNs);
+  printf("per byte       %.2f ns\n", bytes ? (double) handlerNs / bytes : 0.0);
+  printf("slowest        packet %lu, %u bytes from %u.%u.%u.%u\n", (unsigned long) slowest + 1,
+      packets[slowest].len, packets[slowest].srcIp[0], packets[slowest].srcIp[1],
+      packets[slowest].srcIp[2], packets[slowest].srcIp[3]);
+#if MDNS_ENABLE_STATS
+  const EC_MDNSStats& stats = EC_MDNSResponder::getStats();
+  printf("bytes scanned  %lu of %lu\n", (unsigned long) stats.bytesScanned, bytes);
+  printf("not answered   short %lu, header %lu, name %lu, malformed %lu, rate %lu, known %lu\n",
+      (unsigned long) stats.rejects[MDNS_REJECT_SHORT], (unsigned long) stats.rejects[MDNS_REJECT_HEADER],
+      (unsigned long) stats.rejects[MDNS_REJECT_NAME], (unsigned long) stats.rejects[MDNS_REJECT_MALFORMED],
+      (unsigned long) stats.rejects[MDNS_REJECT_RATE], (unsigned long) stats.rejects[MDNS_REJECT_KNOWN]);
+#endif
+
+  if (slowPath) {
+    FILE* f = fopen(slowPath, "wb");
+    if (!f || fwrite(packets[slowest].data, 1, packets[slowest].len, f) != packets[slowest].len) {
+      fail(slowPath, strerror(errno));
+    }
+    fclose(f);
+  }
+  if (out) {
+    fclose(out);
+  }
+  free(times);
+  return 0;
+}
@@ -0,0 +1,203 @@
+// Runs the responder on a UDP socket, as a target for loadgen or any other
+// mDNS client.
+//
+//   responder [-l ip[:port]] [-n name] [-s type.proto]...
+//
+// It listens on 127.0.0.1:5353 unless told otherwise, and answers with that
+// address. Datagrams to the socket are handed to onUdpReceive() as if sent to
+// the mDNS group, and everything the responder sends leaves through the
+// socket: to the address it is meant for, and for the group to each client
+// that queried from port 5353 in the last CLIENT_TIMEOUT seconds, which is
+// what multicast on a link would reach. Answers sent while a query is handled
+// carry its ID, where multicast answers otherwise have 0, so that clients can
+// match them to their queries. poll() runs between packets and at least every
+// POLL_INTERVAL ms. On SIGINT or SIGTERM it prints what it did and exits.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "EC_MDNSResponder.h"
+#include "tool.h"
+
+#define MDNS_PORT 5353
+#define MAX_CLIENTS 16
+#define CLIENT_TIMEOUT 10     // s
+#define POLL_INTERVAL 5       // ms
+
+static int sock;
+static struct {
+  uint8_t ip[4];
+  uint32_t seen;              // millis()
+} clients[MAX_CLIENTS];
+static const uint8_t* query;  // Query being handled, or NULL
+static volatile sig_atomic_t stop;
+static unsigned long received;
+static unsigned long sent;
+static unsigned long sendErrors;
+
+static void fail(const char* message, const char* detail) {
+  fprintf(stderr, "responder: %s%s%s\n", message, detail ? ": " : "", detail ? detail : "");
+  exit(1);
+}
+
+static void onSignal(int) {
+  stop = 1;
+}
+
+static void updateClock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  hostMicros = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sendPacket(const uint8_t* ip, uint16_t port, const uint8_t* data, uint16_t len) {
+  struct sockaddr_in to;
+  memset(&to, 0, sizeof(to));
+  to.sin_family = AF_INET;
+  to.sin_port = htons(port);
+  memcpy(&to.sin_addr, ip, 4);
+  if (sendto(sock, data, len, 0, (struct sockaddr*) &to, sizeof(to)) == len) {
+    sent++;
+  }
+  else {
+    sendErrors++;
+  }
+}
+
+static void onSent(const HostPacket& packet) {
+  // The stub's buffer is the responder's, so tag a copy.
+  uint8_t data[HOST_BUFFER_SIZE];
+  memcpy(data, packet.data, packet.len);
+  if (query && packet.len >= 2 && data[0] == 0 && data[1] == 0) {
+    data[0] = query[0];
+    data[1] = query[1];
+  }
+  if (packet.dstIp[0] >= 224 && packet.dstIp[0] <= 239) {
+    for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+      if (clients[i].seen && millis() - clients[i].seen < CLIENT_TIMEOUT * 1000UL) {
+        sendPacket(clients[i].ip, MDNS_PORT, data, packet.len);
+      }
+    }
+  }
+  else {
+    sendPacket(packet.dstIp, packet.dstPort, data, packet.len);
+  }
+}
+
+// Remembers a client that queries from port 5353 as a member of the group.
+static void addClient(const uint8_t* ip) {
+  uint8_t oldest = 0;
+  for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+    if (clients[i].seen && memcmp(clients[i].ip, ip, 4) == 0) {
+      oldest = i;
+      break;
+    }
+    if (clients[i].seen < clients[oldest].seen) {
+      oldest = i;
+    }
+  }
+  memcpy(clients[oldest].ip, ip, 4);
+  clients[oldest].seen = millis() | 1;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: responder [-l ip[:port]] [-n name] [-s type.proto]...\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  static const uint8_t group[4] = { 224, 0, 0, 251 };
+  uint8_t ip[4] = { 127, 0, 0, 1 };
+  uint16_t port = MDNS_PORT;
+  const char* name = "arduino";
+  const char* services[8];
+  uint8_t serviceCount = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "l:n:s:")) != -1) {
+    switch (opt) {
+      case 'l': if (!parseAddress(optarg, ip, &port)) usage(); break;
+      case 'n': name = optarg; break;
+      case 's': if (serviceCount == 8) usage(); services[serviceCount++] = optarg; break;
+      default: usage();
+    }
+  }
+  if (optind != argc) {
+    usage();
+  }
+
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  int on = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  struct sockaddr_in local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  memcpy(&local.sin_addr, ip, 4);
+  if (sock < 0 || bind(sock, (struct sockaddr*) &local, sizeof(local)) != 0) {
+    fail("cannot listen", strerror(errno));
+  }
+
+  updateClock();
+  memcpy(EtherCard::myip, ip, 4);
+  if (!EC_MDNSResponder::begin(name, ether)) {
+    fail("begin() failed for", name);
+  }
+  for (uint8_t i = 0; i < serviceCount; i++) {
+    if (!addService(services[i], 80)) {
+      fail("cannot add service", services[i]);
+    }
+  }
+  hostSent = onSent;
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  fprintf(stderr, "responder: %s.local on %u.%u.%u.%u:%u\n", name, ip[0], ip[1], ip[2], ip[3], port);
+
+  struct pollfd wait = { sock, POLLIN, 0 };
+  while (!stop) {
+    poll(&wait, 1, POLL_INTERVAL);
+    // Take whatever has queued up, then let poll() run.
+    for (;;) {
+      uint8_t data[HOST_BUFFER_SIZE - UDP_DATA_P];
+      struct sockaddr_in from;
+      socklen_t fromLen = sizeof(from);
+      ssize_t len = recvfrom(sock, data, sizeof(data), MSG_DONTWAIT, (struct sockaddr*) &from, &fromLen);
+      if (len < 0) {
+        break;
+      }
+      updateClock();
+      received++;
+      uint8_t source[4];
+      memcpy(source, &from.sin_addr, 4);
+      uint16_t sourcePort = ntohs(from.sin_port);
+      if (sourcePort == MDNS_PORT) {
+        addClient(source);
+      }
+      uint8_t mac[6] = { 0x02, 0x00, source[0], source[1], source[2], source[3] };
+      query = data;
+      hostReceive(mac, source, sourcePort, group, MDNS_PORT, data, len);
+      query = NULL;
+    }
+    updateClock();
+    EC_MDNSResponder::poll();
+  }
+
+  printf("received %lu queries, sent %lu answers", received, sent);
+  if (sendErrors) {
+    printf(", %lu failed to send", sendErrors);
+  }
+  printf("\n");
+#if MDNS_ENABLE_STATS
+  const EC_MDNSStats& stats = EC_MDNSResponder::getStats();
+  printf("not answered: short %lu, header %lu, name %lu, malformed %lu, rate %lu, known %lu\n",
+      (unsigned long) stats.rejects[MDNS_REJECT_SHORT], (unsigned long) stats.rejects[MDNS_REJECT_HEADER],
+      (unsigned long) stats.rejects[MDNS_REJECT_NAME], (unsigned long) stats.rejects[MDNS_REJECT_MALFORMED],
+      (unsigned long) stats.rejects[MDNS_REJECT_RATE], (unsigned long) stats.rejects[MDNS_REJECT_KNOWN]);
+#endif
+  close(sock);
+  return 0;
+}
@@ -0,0 +1,48 @@
+// One node of netsim: the responder with its stand-ins, built as a shared
+// object that netsim loads once per node, so that every node has its own copy
+// of the responder's static state. Linked with -Bsymbolic, so that a copy
+// only ever calls into itself.
+
+#include "EC_MDNSResponder.h"
+#include "simnode.h"
+
+extern "C" bool nodeBegin(const char* name, const uint8_t ip[4], const char* service, HostSendHook sent) {
+  memcpy(EtherCard::myip, ip, 4);
+  uint8_t mac[6] = { 0x02, 0x00, ip[0], ip[1], ip[2], ip[3] };
+  memcpy(EtherCard::mymac, mac, 6);
+  hostSent = sent;
+  if (!EC_MDNSResponder::begin(name, ether)) {
+    return false;
+  }
+  if (!service) {
+    return true;
+  }
+#if MDNS_ENABLE_SERVICES
+  char type[64];
+  const char* dot = strchr(service, '.');
+  if (!dot || dot - service >= (int) sizeof(type)) {
+    return false;
+  }
+  memcpy(type, service, dot - service);
+  type[dot - service] = 0;
+  uint8_t handle = EC_MDNSResponder::addService(type, dot + 1, 80);
+  // The TXT record changes from empty, so it is announced.
+  return handle != MDNS_NO_SERVICE && EC_MDNSResponder::setTxt(handle, PSTR("node"), name);
+#else
+  return false;
+#endif
+}
+
+extern "C" void nodeClock(uint64_t us) {
+  hostMicros = us;
+}
+
+extern "C" bool nodeReceive(const uint8_t srcIp[4], uint16_t srcPort, const uint8_t dstIp[4], uint16_t dstPort,
+    const uint8_t* data, uint16_t len) {
+  uint8_t mac[6] = { 0x02, 0x00, srcIp[0], srcIp[1], srcIp[2], srcIp[3] };
+  return hostReceive(mac, srcIp, srcPort, dstIp, dstPort, data, len);
+}
+
+extern "C" void nodePoll() {
+  EC_MDNSResponder::poll();
+}
@@ -0,0 +1,23 @@
+// The functions netsim looks up in every copy of simnode.so
+
+#ifndef HostSimNode_h
+#define HostSimNode_h
+
+#include "EtherCard.h"
+
+// Starts the responder for name.local at ip, advertising service
+// ("_http._tcp") with a TXT record unless it is NULL. Everything it sends goes
+// to sent.
+typedef bool (*NodeBegin)(const char* name, const uint8_t ip[4], const char* service, HostSendHook sent);
+
+// Sets the node's clock.
+typedef void (*NodeClock)(uint64_t us);
+
+// Hands a datagram to the node, as hostReceive() does.
+typedef bool (*NodeReceive)(const uint8_t srcIp[4], uint16_t srcPort, const uint8_t dstIp[4], uint16_t dstPort,
+    const uint8_t* data, uint16_t len);
+
+// Runs the responder's poll().
+typedef void (*NodePoll)();
+
+#endif
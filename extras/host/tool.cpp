@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include "EC_MDNSResponder.h"
+#include "tool.h"
+
+bool parseAddress(const char* text, uint8_t ip[4], uint16_t* port) {
+  unsigned a, b, c, d, p;
+  char end;
+  int n = sscanf(text, "%u.%u.%u.%u:%u%c", &a, &b, &c, &d, &p, &end);
+  if (n < 4 || n > (port ? 5 : 4) || a > 255 || b > 255 || c > 255 || d > 255 || (n == 5 && (p == 0 || p > 65535))) {
+    return false;
+  }
+  if (n == 4 && strchr(text, ':')) {
+    return false;
+  }
+  ip[0] = a;
+  ip[1] = b;
+  ip[2] = c;
+  ip[3] = d;
+  if (n == 5) {
+    *port = p;
+  }
+  return true;
+}
+
+bool addService(const char* service, uint16_t port) {
+#if MDNS_ENABLE_SERVICES
+  char type[64];
+  const char* dot = strchr(service, '.');
+  if (!dot || dot - service >= (int) sizeof(type)) {
+    return false;
+  }
+  memcpy(type, service, dot - service);
+  type[dot - service] = 0;
+  return EC_MDNSResponder::addService(type, dot + 1, port) != MDNS_NO_SERVICE;
+#else
+  (void) service;
+  (void) port;
+  return false;
+#endif
+}
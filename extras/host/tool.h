@@ -0,0 +1,17 @@
+// Helpers shared by the host tools
+
+#ifndef HostTool_h
+#define HostTool_h
+
+#include <stdint.h>
+
+// Parses "a.b.c.d", or "a.b.c.d:port" when port is not NULL (which it then
+// leaves alone if none is given).
+bool parseAddress(const char* text, uint8_t ip[4], uint16_t* port);
+
+// Advertises a service given as "_http._tcp" on port. False if it is not of
+// that form, the library is built without MDNS_ENABLE_SERVICES or
+// addService() fails.
+bool addService(const char* service, uint16_t port);
+
+#endif